@@ -18,6 +18,14 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include "cmdline.h"
+#include "shmRing.h"
+#include "unixServer.h"
+#include "pipeOutput.h"
+#include "frameStore.h"
+#include "frameArena.h"
+#include "pixelRaster.h"
+#include "metrics.h"
+#include "pbxTeleporter.h"
 
 // title and version
 const char *argp_program_version = "pbxTeleporter v1.1.4 for Linux/Pi";
@@ -38,6 +46,38 @@ static struct argp_option options[] = {
 		{"ip"          ,'i',"<IPv4 address>" , 0, "IPv4 address to use for net communication. Default: 0.0.0.0 (All available)"},
 		{"listen-port" ,'l',"<portno>", 0,"TCP/IP port number on which to listen for commands. Default 8081."},
 		{"send-port"   ,'s',"<portno>", 0,"TCP/IP port number on which to send data. Default 8082."},
+		{"shm"         ,'m',"<name>", OPTION_ARG_OPTIONAL,"Publish frames to a shared memory ring for local consumers, who need to run as our user or group. Default name: /pbxTeleporter"},
+		{"shm-slots"   ,OPT_SHM_SLOTS,"<n>", 0,"Number of frame slots in the shared memory ring. Default 4."},
+		{"unix"        ,'u',"<path>", OPTION_ARG_OPTIONAL,"Serve frames to local clients on a unix domain socket. Default path: /tmp/pbxTeleporter.sock"},
+		{"pipe"        ,'p',"<path>", 0,"Write frames as raw video to a FIFO or file. Use - for stdout."},
+		{"pipe-format" ,OPT_PIPE_FORMAT,"rgb24|y4m", 0,"Raw video format. Default rgb24."},
+		{"pipe-size"   ,OPT_PIPE_SIZE,"<W>x<H>", 0,"Lay pixels out row by row on a W x H grid. Required for y4m."},
+		{"pipe-fps"    ,OPT_PIPE_FPS,"<fps>", 0,"Frame rate written to the y4m header. Default 30."},
+		{"rgbw"        ,OPT_RGBW,"convert|passthrough", 0,"Convert RGBW channels to RGB, or pass them through as 4 byte pixels, which UDP clients can still ask to have folded to RGB. Default convert."},
+		{"metrics"     ,OPT_METRICS,"<port>", OPTION_ARG_OPTIONAL,"Serve Prometheus metrics over HTTP. Default port 9180."},
+		{"trace"       ,OPT_TRACE,"<file>", 0,"Record a timeline of every frame in Chrome trace JSON, for chrome://tracing or Perfetto."},
+		{"baud"        ,OPT_BAUD,"<bps>", 0,"Serial bit rate. Any rate the adapter can make. Default 2000000."},
+		{"watchdog"    ,OPT_WATCHDOG,"<ms>|off", 0,"Reset the serial stream after this long without usable data. Default: 1.5 frame times, 20-1000 ms."},
+		{"perf"        ,OPT_PERF,0, 0,"Count CPU cycles, instructions, cache misses and context switches per frame."},
+		{"dedup"       ,OPT_DEDUP,"<ms>", OPTION_ARG_OPTIONAL,"Don't send unchanged frames, except every <ms> as a keepalive. Default 1000."},
+		{"max-pixels"  ,OPT_MAX_PIXELS,"<n>", 0,"Most pixels in a frame, all channels together. Up to 65535 per channel. Default 4096."},
+		{"hugepages"   ,OPT_HUGEPAGES,0, 0,"Put frame buffers on huge pages if the system has them."},
+		{"mlock"       ,OPT_MLOCK,0, 0,"Lock frame buffers in memory."},
+		{"always-decode",OPT_ALWAYS_DECODE,0, 0,"Decode every frame, even when no client is listening."},
+		{"mlockall"    ,OPT_MLOCKALL,0, 0,"Lock all memory, so nothing the bridge uses is paged out."},
+		{"rt-priority" ,OPT_RT_PRIORITY,"<1-99>", 0,"Read the serial port at SCHED_FIFO real-time priority. Needs root or CAP_SYS_NICE."},
+		{"ingest-cpu"  ,OPT_INGEST_CPU,"<n>", 0,"Run the serial thread on CPU n."},
+		{"send-cpu"    ,OPT_SEND_CPU,"<n>", 0,"Run the transform and send thread on CPU n."},
+		{"gamma"       ,OPT_GAMMA,"<g>", 0,"Gamma correct frames before sending them. Default 1.0 (off)."},
+		{"brightness"  ,OPT_BRIGHTNESS,"<0-1>", 0,"Scale frame brightness before sending. Default 1.0."},
+		{"white-point" ,OPT_WHITE_POINT,"<r>,<g>,<b>[,<w>]", 0,"Scale each color (0-1) to set the white point. Default 1,1,1."},
+		{"correct"     ,OPT_CORRECT,"<file>", 0,"Per-channel color correction settings. Reread on SIGHUP."},
+		{"map"         ,OPT_MAP,"<file>", 0,"Put pixels in logical order using a pixel index map."},
+		{"raster"      ,OPT_RASTER,"<file>", 0,"Draw frames as images using an x,y pixel map. Needs --raster-out."},
+		{"raster-size" ,OPT_RASTER_SIZE,"<W>x<H>", 0,"Image size. Default 256x256."},
+		{"raster-mode" ,OPT_RASTER_MODE,"nearest|splat", 0,"Light the nearest image pixel, or draw blended dots. Default nearest."},
+		{"raster-out"  ,OPT_RASTER_OUT,"<path>", 0,"Write images as raw video to a FIFO or file. Use - for stdout."},
+		{"raster-format",OPT_RASTER_FORMAT,"rgb24|y4m", 0,"Image video format. Default rgb24. Frame rate from --pipe-fps."},
 		{0}
 };
 
@@ -77,6 +117,195 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state){
 	case 's':  // send udp port
 		arguments->send_port = atoi(arg);
 		break;
+	case 'm':  // shared memory frame ring
+		arguments->shm_name = (arg != NULL) ? arg : SHM_DEFAULT_NAME;
+		if (arguments->shm_name[0] != '/') {
+			argp_error(state,"Shared memory name must start with '/'. ");
+		}
+		break;
+	case OPT_SHM_SLOTS:
+		arguments->shm_slots = atoi(arg);
+		if (arguments->shm_slots < 2 || arguments->shm_slots > SHM_MAX_SLOTS) {
+			argp_error(state,"Invalid number of shared memory slots. ");
+		}
+		break;
+
+	case 'u':  // unix domain socket server
+		arguments->unix_path = (arg != NULL) ? arg : DEFAULT_UNIX_PATH;
+		break;
+
+	case 'p':  // raw video output
+		arguments->pipe_path = arg;
+		break;
+	case OPT_PIPE_FORMAT:
+		if (strcmp(arg,"rgb24") == 0) {
+			arguments->pipe_format = PIPE_FORMAT_RGB24;
+		}
+		else if (strcmp(arg,"y4m") == 0) {
+			arguments->pipe_format = PIPE_FORMAT_Y4M;
+		}
+		else {
+			argp_error(state,"Invalid pipe format. ");
+		}
+		break;
+	case OPT_PIPE_SIZE:
+		if ((sscanf(arg,"%dx%d",&arguments->pipe_width,&arguments->pipe_height) != 2) ||
+			(arguments->pipe_width <= 0) || (arguments->pipe_height <= 0)) {
+			argp_error(state,"Invalid pipe size. ");
+		}
+		break;
+	case OPT_PIPE_FPS:
+		arguments->pipe_fps = atoi(arg);
+		if (arguments->pipe_fps <= 0) {
+			argp_error(state,"Invalid pipe frame rate. ");
+		}
+		break;
+	case OPT_RGBW:
+		if (strcmp(arg,"convert") == 0) {
+			arguments->rgbw_mode = RGBW_CONVERT;
+		}
+		else if (strcmp(arg,"passthrough") == 0) {
+			arguments->rgbw_mode = RGBW_PASSTHROUGH;
+		}
+		else {
+			argp_error(state,"Invalid RGBW mode. ");
+		}
+		break;
+	case OPT_METRICS:
+		arguments->metrics_port = (arg != NULL) ? atoi(arg) : DEFAULT_METRICS_PORT;
+		if (arguments->metrics_port <= 0 || arguments->metrics_port > 65535) {
+			argp_error(state,"Invalid metrics port. ");
+		}
+		break;
+	case OPT_TRACE:
+		arguments->trace_path = arg;
+		break;
+	case OPT_PERF:
+		arguments->perf = 1;
+		break;
+	case OPT_BAUD:
+		arguments->baud = atoi(arg);
+		if (arguments->baud <= 0) {
+			argp_error(state,"Invalid bit rate. ");
+		}
+		break;
+	case OPT_WATCHDOG:
+		if (strcmp(arg,"off") == 0) {
+			arguments->watchdog = WATCHDOG_OFF;
+		}
+		else {
+			arguments->watchdog = atoi(arg);
+			if (arguments->watchdog <= 0) {
+				argp_error(state,"Invalid watchdog timeout. ");
+			}
+		}
+		break;
+	case OPT_DEDUP:
+		arguments->keepalive = (arg != NULL) ? atoi(arg) : DEFAULT_KEEPALIVE_MS;
+		if (arguments->keepalive <= 0) {
+			argp_error(state,"Invalid keepalive interval. ");
+		}
+		break;
+	case OPT_MAX_PIXELS:
+		arguments->max_pixels = atoi(arg);
+		if (arguments->max_pixels < 1 || arguments->max_pixels > MAX_FRAME_PIXELS) {
+			argp_error(state,"Invalid pixel count. ");
+		}
+		break;
+	case OPT_HUGEPAGES:
+		arguments->arena_flags |= ARENA_HUGEPAGES;
+		break;
+	case OPT_MLOCK:
+		arguments->arena_flags |= ARENA_LOCKED;
+		break;
+	case OPT_MLOCKALL:
+		arguments->mlockall = 1;
+		break;
+	case OPT_ALWAYS_DECODE:
+		arguments->always_decode = 1;
+		break;
+	case OPT_RT_PRIORITY:
+		arguments->rt_priority = atoi(arg);
+		if (arguments->rt_priority < 1 || arguments->rt_priority > 99) {
+			argp_error(state,"Invalid real-time priority. ");
+		}
+		break;
+	case OPT_INGEST_CPU:
+	case OPT_SEND_CPU:
+		if (!isdigit((unsigned char) arg[0])) {
+			argp_error(state,"Invalid CPU number. ");
+		}
+		if (key == OPT_INGEST_CPU) arguments->ingest_cpu = atoi(arg);
+		else arguments->send_cpu = atoi(arg);
+		break;
+	case OPT_GAMMA:
+		arguments->correct.gamma = atof(arg);
+		if (arguments->correct.gamma <= 0.0f) {
+			argp_error(state,"Invalid gamma. ");
+		}
+		arguments->correct_enabled = 1;
+		break;
+	case OPT_BRIGHTNESS:
+		arguments->correct.brightness = atof(arg);
+		if (arguments->correct.brightness < 0.0f || arguments->correct.brightness > 1.0f) {
+			argp_error(state,"Invalid brightness. ");
+		}
+		arguments->correct_enabled = 1;
+		break;
+	case OPT_WHITE_POINT: {
+		float *w = arguments->correct.white;
+		int n = sscanf(arg,"%f,%f,%f,%f",&w[0],&w[1],&w[2],&w[3]);
+		if (n < 3) {
+			argp_error(state,"Invalid white point. ");
+		}
+		for (int i = 0; i < n; i++) {
+			if (w[i] < 0.0f || w[i] > 1.0f) argp_error(state,"Invalid white point. ");
+		}
+		arguments->correct_enabled = 1;
+		break;
+	}
+	case OPT_CORRECT:
+		arguments->correct_path = arg;
+		arguments->correct_enabled = 1;
+		break;
+	case OPT_MAP:
+		arguments->map_path = arg;
+		break;
+	case OPT_RASTER:
+		arguments->raster_path = arg;
+		break;
+	case OPT_RASTER_SIZE:
+		if ((sscanf(arg,"%dx%d",&arguments->raster_width,&arguments->raster_height) != 2) ||
+			(arguments->raster_width <= 0) || (arguments->raster_height <= 0) ||
+			((long) arguments->raster_width * arguments->raster_height > MAX_RASTER_PIXELS)) {
+			argp_error(state,"Invalid raster size. ");
+		}
+		break;
+	case OPT_RASTER_MODE:
+		if (strcmp(arg,"nearest") == 0) {
+			arguments->raster_mode = RASTER_NEAREST;
+		}
+		else if (strcmp(arg,"splat") == 0) {
+			arguments->raster_mode = RASTER_SPLAT;
+		}
+		else {
+			argp_error(state,"Invalid raster mode. ");
+		}
+		break;
+	case OPT_RASTER_OUT:
+		arguments->raster_out = arg;
+		break;
+	case OPT_RASTER_FORMAT:
+		if (strcmp(arg,"rgb24") == 0) {
+			arguments->raster_format = PIPE_FORMAT_RGB24;
+		}
+		else if (strcmp(arg,"y4m") == 0) {
+			arguments->raster_format = PIPE_FORMAT_Y4M;
+		}
+		else {
+			argp_error(state,"Invalid raster format. ");
+		}
+		break;
 
 	case ARGP_KEY_ARG: // process serial port argument
 		if(state->arg_num > 1) {
@@ -93,6 +322,16 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state){
 	case ARGP_KEY_END: // make sure we got our serial port
 		if(state->arg_num < 1)
 			argp_usage(state);
+		if ((arguments->pipe_format == PIPE_FORMAT_Y4M) && (arguments->pipe_width == 0)) {
+			argp_error(state,"y4m output needs --pipe-size. ");
+		}
+		if ((arguments->raster_path != NULL) && (arguments->raster_out == NULL)) {
+			argp_error(state,"--raster needs --raster-out. ");
+		}
+		if ((arguments->raster_path != NULL) && (arguments->pipe_path != NULL) &&
+			(strcmp(arguments->raster_out,"-") == 0) && (strcmp(arguments->pipe_path,"-") == 0)) {
+			argp_error(state,"Only one video output can use stdout. ");
+		}
 		break;
 
 	default:
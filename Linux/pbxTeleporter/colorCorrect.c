@@ -0,0 +1,175 @@
+/* colorCorrect.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Server side color correction.  See colorCorrect.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "colorCorrect.h"
+#include "pixelKernels.h"
+
+void correctionDefaults(correction *c) {
+	c->gamma = 1.0f;
+	c->brightness = 1.0f;
+	for (int i = 0; i < 4; i++) c->white[i] = 1.0f;
+}
+
+// build the lookup tables for one channel from its settings
+static void buildTables(colorCorrector *cc, int ch) {
+	correction *c = &cc->settings[ch];
+	int identity = 1;
+
+	for (int e = 0; e < 4; e++) {
+		float scale = c->brightness * c->white[e] * 255.0f;
+		for (int v = 0; v < 256; v++) {
+			float out = powf(v / 255.0f, c->gamma) * scale + 0.5f;
+			uint8_t b = (out >= 255.0f) ? 255 : (out <= 0.0f) ? 0 : (uint8_t) out;
+			cc->lut[ch][e][v] = b;
+			if (b != v) identity = 0;
+		}
+	}
+	cc->identity[ch] = identity;
+}
+
+// apply one "name=value" setting.  Returns 0 if it made sense.
+static int parseSetting(correction *c, char *tok) {
+	float w[4];
+	int n;
+
+	if (sscanf(tok, "gamma=%f", &c->gamma) == 1) {
+		return (c->gamma > 0.0f) ? 0 : -1;
+	}
+	if (sscanf(tok, "brightness=%f", &c->brightness) == 1) {
+		return (c->brightness >= 0.0f && c->brightness <= 1.0f) ? 0 : -1;
+	}
+	n = sscanf(tok, "white=%f,%f,%f,%f", &w[0], &w[1], &w[2], &w[3]);
+	if (n >= 3) {
+		for (int i = 0; i < n; i++) {
+			if (w[i] < 0.0f || w[i] > 1.0f) return -1;
+			c->white[i] = w[i];
+		}
+		return 0;
+	}
+	return -1;
+}
+
+// read the correction file into settings, starting from the command line
+// values.  Returns 0 on success, -1 (and says why) if the file is bad.
+static int loadFile(colorCorrector *cc, correction *settings) {
+	FILE *f;
+	char line[256], *tok, *save;
+	int lineNo = 0, first, last, res = 0;
+
+	for (int i = 0; i < MAX_CHANNELS; i++) settings[i] = cc->global;
+	if (cc->path == NULL) return 0;
+
+	f = fopen(cc->path, "r");
+	if (f == NULL) {
+		printf("pbxTeleporter: unable to open correction file %s\n", cc->path);
+		return -1;
+	}
+
+	while (res == 0 && fgets(line, sizeof(line), f) != NULL) {
+		lineNo++;
+		if ((tok = strchr(line, '#')) != NULL) *tok = 0;
+
+		tok = strtok_r(line, " \t\r\n", &save);
+		if (tok == NULL) continue;
+
+		if (strcmp(tok, "all") == 0) {
+			first = 0;
+			last = MAX_CHANNELS - 1;
+		}
+		else if (sscanf(tok, "%d-%d", &first, &last) != 2) {
+			if (sscanf(tok, "%d", &first) != 1) first = -1;
+			last = first;
+		}
+		if (first < 0 || last < first || last >= MAX_CHANNELS) {
+			res = -1;
+			break;
+		}
+
+		while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			for (int i = first; i <= last && res == 0; i++) {
+				res = parseSetting(&settings[i], tok);
+			}
+		}
+	}
+	fclose(f);
+
+	if (res) printf("pbxTeleporter: %s line %d: bad correction setting\n", cc->path, lineNo);
+	return res;
+}
+
+colorCorrector *createColorCorrector(const correction *global, const char *path) {
+	colorCorrector *cc;
+
+	cc = (colorCorrector *) calloc(1, sizeof(colorCorrector));
+	cc->global = *global;
+	cc->path = (path != NULL) ? strdup(path) : NULL;
+
+	if (loadFile(cc, cc->settings) < 0) {
+		free(cc->path);
+		free(cc);
+		return NULL;
+	}
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		buildTables(cc, i);
+	}
+
+	return cc;
+}
+
+// reread the correction file and rebuild the tables for channels whose
+// settings changed.  A bad file leaves everything as it was.  Returns the
+// number of channels changed, or -1.
+int colorCorrectReload(colorCorrector *cc) {
+	correction settings[MAX_CHANNELS];
+	int changed = 0;
+
+	if (loadFile(cc, settings) < 0) return -1;
+
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		if (memcmp(&settings[i], &cc->settings[i], sizeof(correction)) == 0) continue;
+		cc->settings[i] = settings[i];
+		buildTables(cc, i);
+		changed++;
+	}
+	return changed;
+}
+
+// make dst a corrected copy of src, with its pixel data in buffer, which
+// must be as big as src's.
+void colorCorrectFrame(colorCorrector *cc, const frameStore *src, frameStore *dst, uint8_t *buffer) {
+	*dst = *src;
+	dst->data = buffer;
+
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		const channelEntry *e = &src->dir[i];
+		if (e->length == 0) continue;
+
+		if (cc->identity[i]) {
+			memcpy(buffer + e->offset, src->data + e->offset, e->length);
+		}
+		else {
+			applyLut(src->data + e->offset, buffer + e->offset, e->pixels, e->elements,
+				(const uint8_t (*)[256]) cc->lut[i]);
+		}
+	}
+}
+
+void destroyColorCorrector(colorCorrector *cc) {
+	if (cc == NULL) return;
+
+	free(cc->path);
+	free(cc);
+}
@@ -0,0 +1,90 @@
+/* frameArena.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Startup allocated memory for frame buffers.  See frameArena.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "frameArena.h"
+
+// map the arena.  Huge pages and locking are best effort -- if the system
+// won't give us what we asked for we say so and carry on without it.
+frameArena *createFrameArena(size_t size, int flags) {
+	frameArena *arena;
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+	arena = (frameArena *) calloc(1, sizeof(frameArena));
+	arena->base = MAP_FAILED;
+
+	if (flags & ARENA_HUGEPAGES) {
+		arena->size = (size + HUGEPAGE_SIZE - 1) & ~((size_t) HUGEPAGE_SIZE - 1);
+		arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (arena->base != MAP_FAILED) {
+			arena->flags |= ARENA_HUGETLB;
+		}
+	}
+
+	if (arena->base == MAP_FAILED) {
+		if (!(flags & ARENA_HUGEPAGES)) {
+			arena->size = (size + page - 1) & ~(page - 1);
+		}
+		arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (arena->base == MAP_FAILED) {
+			printf("pbxTeleporter: unable to allocate %zu byte frame arena: %s\n", arena->size, strerror(errno));
+			free(arena);
+			return NULL;
+		}
+		if ((flags & ARENA_HUGEPAGES) && (madvise(arena->base, arena->size, MADV_HUGEPAGE) == 0)) {
+			arena->flags |= ARENA_THP;
+		}
+	}
+
+// fault everything in now rather than on the first big frame
+	memset(arena->base, 0, arena->size);
+
+	if (flags & ARENA_LOCKED) {
+		if (mlock(arena->base, arena->size) == 0) {
+			arena->flags |= ARENA_LOCKED;
+		}
+		else {
+			printf("pbxTeleporter: unable to lock frame arena: %s\n", strerror(errno));
+		}
+	}
+
+	return arena;
+}
+
+// hand out the next size bytes, cache line aligned.  Returns NULL
+// if the arena is full.
+void *arenaAlloc(frameArena *arena, size_t size) {
+	uint8_t *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+	if (arena->used + size > arena->size) return NULL;
+
+	p = arena->base + arena->used;
+	arena->used += size;
+	return p;
+}
+
+void destroyFrameArena(frameArena *arena) {
+	if (arena == NULL) return;
+
+	if (arena->flags & ARENA_LOCKED) munlock(arena->base, arena->size);
+	munmap(arena->base, arena->size);
+	free(arena);
+}
@@ -0,0 +1,102 @@
+/* frameQueue.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Serial thread to transform thread frame handoff.  See frameQueue.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <string.h>
+
+#include "frameQueue.h"
+#include "metrics.h"
+
+// carve the slots' buffers out of the arena.  Returns 0 on success.
+int frameQueueInit(frameQueue *q, frameArena *arena, size_t capacity, uint32_t maxPixels) {
+	memset(q, 0, sizeof(frameQueue));
+
+	for (int i = 0; i < FRAME_QUEUE_SLOTS; i++) {
+		uint8_t *data = arenaAlloc(arena, capacity);
+		uint8_t *brightness = arenaAlloc(arena, maxPixels);
+		if (data == NULL || brightness == NULL) return -1;
+		frameStoreInit(&q->slots[i], data, capacity, brightness, maxPixels);
+	}
+	q->write = 0;
+	q->ready = 1;
+	q->read = 2;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	return 0;
+}
+
+// called by the serial thread on DRAW_ALL.  The copy happens outside the
+// lock, since nobody else touches the write slot.
+void frameQueuePut(frameQueue *q, const frameStore *fs) {
+	int t;
+
+	frameStoreCopy(&q->slots[q->write], fs);
+
+	pthread_mutex_lock(&q->lock);
+	t = q->ready;
+	q->ready = q->write;
+	q->write = t;
+	if (q->fresh) {
+		q->dropped++;
+		metricAdd(M_FRAMES_SKIPPED,1);
+	}
+	q->fresh = 1;
+	q->frames++;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+// called by the transform thread.  Waits for a frame newer than the last
+// one it took, or for frameQueueWake(), and sets *woken if it was woken.
+// Hands back the last frame's slot and returns the new frame, or NULL if
+// there isn't one or the queue has been stopped.
+frameStore *frameQueueTake(frameQueue *q, int *woken) {
+	int t;
+
+	pthread_mutex_lock(&q->lock);
+	while (!q->fresh && !q->woken && !q->stopped) {
+		pthread_cond_wait(&q->cond, &q->lock);
+	}
+	*woken = q->woken && !q->stopped;
+	q->woken = 0;
+	if (q->stopped || !q->fresh) {
+		pthread_mutex_unlock(&q->lock);
+		return NULL;
+	}
+	t = q->read;
+	q->read = q->ready;
+	q->ready = t;
+	q->fresh = 0;
+	pthread_mutex_unlock(&q->lock);
+
+	return &q->slots[q->read];
+}
+
+// have the transform thread return from frameQueueTake() even if there's
+// no new frame
+void frameQueueWake(frameQueue *q) {
+	pthread_mutex_lock(&q->lock);
+	q->woken = 1;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void frameQueueStop(frameQueue *q) {
+	pthread_mutex_lock(&q->lock);
+	q->stopped = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void frameQueueDestroy(frameQueue *q) {
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->cond);
+}
@@ -0,0 +1,169 @@
+/* frameStore.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Channel indexed frame store.  See frameStore.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <string.h>
+
+#include "frameStore.h"
+#include "pixelKernels.h"
+
+// brightness must have room for maxPixels bytes.
+void frameStoreInit(frameStore *fs, uint8_t *buffer, size_t capacity, uint8_t *brightness, uint32_t maxPixels) {
+	memset(fs, 0, sizeof(frameStore));
+	fs->data = buffer;
+	fs->capacity = capacity;
+	fs->brightness = brightness;
+	fs->maxPixels = maxPixels;
+}
+
+// returns a pointer to the slot for the specified channel, with room for
+// pixels * elements bytes, or NULL if the channel can't be stored because
+// the frame would go over either its byte or its pixel limit.
+// Slots only move when a channel changes size, which normally happens
+// once, on the first frame after the Pixelblaze is reconfigured.
+uint8_t *frameStoreChannel(frameStore *fs, uint8_t channel, uint16_t pixels, uint8_t elements, uint8_t protocol) {
+	channelEntry *e;
+	size_t newLength, tail;
+	long delta, pixelDelta;
+
+	if (channel >= MAX_CHANNELS) return NULL;
+
+	e = &fs->dir[channel];
+	newLength = (size_t) pixels * elements;
+	delta = (long) newLength - (long) e->length;
+	pixelDelta = (long) pixels - (long) e->pixels;
+
+	if (fs->length + delta > fs->capacity) return NULL;
+	if (fs->pixelCount + pixelDelta > fs->maxPixels) return NULL;
+	if (delta || pixelDelta || (e->elements != elements)) fs->layout++;
+
+// resize slot, moving the channels above it up or down
+	if (delta) {
+		tail = fs->length - (e->offset + e->length);
+		memmove(fs->data + e->offset + newLength, fs->data + e->offset + e->length, tail);
+		for (int i = channel + 1; i < MAX_CHANNELS; i++) {
+			fs->dir[i].offset += delta;
+		}
+		fs->length += delta;
+		e->length = newLength;
+	}
+
+// same again for the brightness plane
+	if (pixelDelta) {
+		tail = fs->pixelCount - (fs->pixelOffset[channel] + e->pixels);
+		memmove(fs->brightness + fs->pixelOffset[channel] + pixels,
+			fs->brightness + fs->pixelOffset[channel] + e->pixels, tail);
+		for (int i = channel + 1; i < MAX_CHANNELS; i++) {
+			fs->pixelOffset[i] += pixelDelta;
+		}
+		fs->pixelCount += pixelDelta;
+	}
+
+	e->pixels = pixels;
+	e->elements = elements;
+	e->protocol = protocol;
+	e->flags &= ~CHANNEL_STALE;
+	fs->received |= (1ULL << channel);
+
+	return fs->data + e->offset;
+}
+
+// returns the channel's part of the brightness plane.  Only valid
+// after frameStoreChannel() has been called for the channel.
+uint8_t *frameStoreBrightness(frameStore *fs, uint8_t channel) {
+	return fs->brightness + fs->pixelOffset[channel];
+}
+
+// called on DRAW_ALL.  Channels we didn't hear from in this frame keep their
+// slot and their previous contents, and are flagged as stale in the directory.
+size_t frameStoreComplete(frameStore *fs) {
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		if (fs->dir[i].length && !(fs->received & (1ULL << i))) {
+			fs->dir[i].flags |= CHANNEL_STALE;
+		}
+	}
+	fs->received = 0;
+
+	return fs->length;
+}
+
+// the serial stream stalled partway through a frame.  Nothing in the
+// store can be trusted to be current, so flag every channel stale and
+// start the next frame from scratch.
+void frameStoreMarkStale(frameStore *fs) {
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		if (fs->dir[i].length) fs->dir[i].flags |= CHANNEL_STALE;
+	}
+	fs->received = 0;
+}
+
+// copy the pixels, brightness and layout of src into dst.  dst keeps its
+// own buffers, which must be at least as big as src's.
+void frameStoreCopy(frameStore *dst, const frameStore *src) {
+	uint8_t *data = dst->data, *brightness = dst->brightness;
+	size_t capacity = dst->capacity;
+
+	memcpy(data, src->data, src->length);
+	memcpy(brightness, src->brightness, src->pixelCount);
+
+	*dst = *src;
+	dst->data = data;
+	dst->brightness = brightness;
+	dst->capacity = capacity;
+}
+
+// make dst a copy of src in buffer with its RGBW channels folded to RGB,
+// for clients that only handle 3 byte pixels.  Returns 0, and leaves dst
+// alone, if src has no RGBW channels.
+int frameStoreFold(frameStore *dst, const frameStore *src, uint8_t *buffer) {
+	uint32_t offset = 0;
+	int rgbw = 0;
+
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		if (src->dir[i].length && src->dir[i].elements == 4) rgbw = 1;
+	}
+	if (!rgbw) return 0;
+
+	*dst = *src;
+	dst->data = buffer;
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		const channelEntry *e = &src->dir[i];
+		channelEntry *out = &dst->dir[i];
+		if (e->length == 0) continue;
+
+		out->offset = offset;
+		if (e->elements == 4) {
+			rgbwToRgb(src->data + e->offset, buffer + offset, e->pixels);
+			out->elements = 3;
+			out->length = e->pixels * 3;
+		}
+		else {
+			memcpy(buffer + offset, src->data + e->offset, e->length);
+		}
+		offset += out->length;
+	}
+	dst->length = offset;
+	return 1;
+}
+
+// hash of everything a client can see in the frame: the directory, the
+// pixels, and the brightness plane if any channel is APA102
+uint64_t frameStoreHash(const frameStore *fs) {
+	uint64_t h = hashBytes((const uint8_t *) fs->dir, sizeof(fs->dir), 0);
+
+	h = hashBytes(fs->data, fs->length, h);
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		if (fs->dir[i].length && fs->dir[i].protocol == PROTOCOL_APA102) {
+			h = hashBytes(fs->brightness, fs->pixelCount, h);
+			break;
+		}
+	}
+	return h;
+}
@@ -0,0 +1,82 @@
+/* frameStore.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Channel indexed frame store.  Each output expander channel writes its
+ * pixels into its own slot in the frame buffer, so a missing or reordered
+ * channel no longer shifts the pixels of every channel after it.  Slots are
+ * laid out back to back in channel order, so the buffer is always the
+ * complete frame with no assembly step.  A per-frame directory records
+ * where each channel lives.
+ *
+ * Channels are numbered as the Pixelblaze addresses them, board * 8 +
+ * channel on that board, so up to 8 expander boards share one frame.
+ *
+ * Alongside the pixel data, the store keeps a brightness plane with one
+ * byte per pixel, laid out the same way.  APA102 channels fill it with
+ * their 5 bit global brightness, which is used to build HDR output.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __framestore_h__
+#define __framestore_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CHANNELS_PER_BOARD 8              // channels on one output expander board
+#define MAX_BOARDS 8                      // boards one Pixelblaze can address
+#define MAX_CHANNELS (MAX_BOARDS * CHANNELS_PER_BOARD)
+#define MAX_CHANNEL_PIXELS 65535          // limit of the expander's 16 bit pixel count
+#define MAX_FRAME_PIXELS (MAX_CHANNELS * MAX_CHANNEL_PIXELS)
+
+enum ChannelProtocol {
+  PROTOCOL_NONE = 0, PROTOCOL_WS2812, PROTOCOL_APA102
+};
+
+// directory entry flags
+#define CHANNEL_STALE 0x01                // channel missing from latest frame, data is from an older one
+
+// channel directory entry
+typedef struct {
+    uint32_t offset;                      // byte offset of channel data in frame
+    uint32_t length;                      // bytes of channel data
+    uint16_t pixels;                      // number of pixels
+    uint8_t  elements;                    // bytes per pixel in the frame buffer
+    uint8_t  protocol;                    // ChannelProtocol
+    uint8_t  flags;
+    uint8_t  reserved[3];
+}  __attribute__((packed)) channelEntry;
+
+typedef struct {
+    uint8_t *data;                        // frame buffer, channels concatenated in order
+    size_t capacity;                      // size of frame buffer
+    size_t length;                        // bytes of pixel data in current layout
+    uint64_t received;                    // bitmask of channels received since last draw
+    channelEntry dir[MAX_CHANNELS];
+    uint8_t *brightness;                  // per-pixel APA102 brightness (0-31)
+    uint32_t pixelOffset[MAX_CHANNELS];   // index of each channel's first pixel
+    uint32_t pixelCount;                  // pixels in current layout
+    uint32_t maxPixels;                   // most pixels a frame may hold, all channels together
+    uint32_t layout;                      // changes whenever a channel's size or shape does
+    uint64_t started;                     // latencyNow() at the first magic word, 0 if none yet
+    uint64_t lastRecord;                  // at the end of the last channel record
+    uint64_t drawn;                       // at DRAW_ALL
+    uint64_t sequence;                    // frames before this one
+} frameStore;
+
+#define APA102_MAX_BRIGHTNESS 31
+
+void frameStoreInit(frameStore *fs, uint8_t *buffer, size_t capacity, uint8_t *brightness, uint32_t maxPixels);
+uint8_t *frameStoreBrightness(frameStore *fs, uint8_t channel);
+uint8_t *frameStoreChannel(frameStore *fs, uint8_t channel, uint16_t pixels, uint8_t elements, uint8_t protocol);
+size_t frameStoreComplete(frameStore *fs);
+void frameStoreCopy(frameStore *dst, const frameStore *src);
+int frameStoreFold(frameStore *dst, const frameStore *src, uint8_t *buffer);
+uint64_t frameStoreHash(const frameStore *fs);
+void frameStoreMarkStale(frameStore *fs);
+
+#endif /* __framestore_h__ */
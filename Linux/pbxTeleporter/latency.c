@@ -0,0 +1,112 @@
+/* latency.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Frame latency histograms.  See latency.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "latency.h"
+
+histogram latencyHist[LATENCY_STAGES];
+
+static const char *stageName[LATENCY_STAGES] = {
+	[STAGE_RECEIVE]  = "receive",
+	[STAGE_DRAW]     = "draw",
+	[STAGE_HANDOFF]  = "handoff",
+	[STAGE_SHM]      = "shm",
+	[STAGE_UNIX]     = "unix",
+	[STAGE_PIPE]     = "pipe",
+	[STAGE_RASTER]   = "raster",
+	[STAGE_UDP]      = "udp",
+	[STAGE_TOTAL]    = "total",
+	[STAGE_UDP_NEXT] = "udp_next",
+	[STAGE_UDP_NOW]  = "udp_now",
+};
+
+static const double quantiles[] = { 50.0, 90.0, 99.0 };
+#define QUANTILES (sizeof(quantiles) / sizeof(quantiles[0]))
+
+// largest value that lands in a slot
+static uint64_t slotValue(int slot) {
+	int shift, step;
+
+	if (slot < HIST_EXACT) return slot;
+	shift = (slot - HIST_EXACT) / HIST_STEPS + 1;
+	step = (slot - HIST_EXACT) % HIST_STEPS + HIST_STEPS;
+	return (((uint64_t) step + 1) << shift) - 1;
+}
+
+// smallest value that at least pct percent of recorded values are at or
+// below, rounded up to the end of its slot but never past the maximum
+uint64_t histogramPercentile(const histogram *h, double pct) {
+	uint64_t total = __atomic_load_n(&h->total, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	uint64_t target, seen = 0;
+
+	if (total == 0) return 0;
+	target = (uint64_t) (total * pct / 100.0 + 0.5);
+	if (target == 0) target = 1;
+
+	for (int i = 0; i < HIST_SLOTS; i++) {
+		seen += __atomic_load_n(&h->count[i], __ATOMIC_RELAXED);
+		if (seen >= target) {
+			uint64_t v = slotValue(i);
+			return (v < max) ? v : max;
+		}
+	}
+	return max;
+}
+
+// human readable table, for SIGUSR1
+void latencyDump(FILE *f) {
+	fprintf(f, "pbxTeleporter: frame latency, microseconds\n");
+	fprintf(f, "    %-8s %10s %8s %8s %8s %8s\n", "stage", "count", "p50", "p90", "p99", "max");
+	for (int s = 0; s < LATENCY_STAGES; s++) {
+		const histogram *h = &latencyHist[s];
+		if (h->total == 0) continue;
+
+		fprintf(f, "    %-8s %10llu", stageName[s], (unsigned long long) h->total);
+		for (unsigned q = 0; q < QUANTILES; q++) {
+			fprintf(f, " %8llu", (unsigned long long) histogramPercentile(h, quantiles[q]));
+		}
+		fprintf(f, " %8llu\n", (unsigned long long) h->max);
+	}
+	fflush(f);
+}
+
+// Prometheus summaries, plus a max gauge.  Returns the length of the text.
+size_t latencyFormat(char *buf, size_t size) {
+	size_t len = 0;
+
+#define APPEND(...) if (len < size) len += snprintf(buf + len, size - len, __VA_ARGS__)
+	APPEND("# HELP pbx_stage_latency_us Time spent in each stage of the frame pipeline.\n"
+		"# TYPE pbx_stage_latency_us summary\n");
+	for (int s = 0; s < LATENCY_STAGES; s++) {
+		const histogram *h = &latencyHist[s];
+		for (unsigned q = 0; q < QUANTILES; q++) {
+			APPEND("pbx_stage_latency_us{stage=\"%s\",quantile=\"%g\"} %llu\n", stageName[s],
+				quantiles[q] / 100.0, (unsigned long long) histogramPercentile(h, quantiles[q]));
+		}
+		APPEND("pbx_stage_latency_us_sum{stage=\"%s\"} %llu\n", stageName[s],
+			(unsigned long long) __atomic_load_n(&h->sum, __ATOMIC_RELAXED));
+		APPEND("pbx_stage_latency_us_count{stage=\"%s\"} %llu\n", stageName[s],
+			(unsigned long long) __atomic_load_n(&h->total, __ATOMIC_RELAXED));
+	}
+
+	APPEND("# HELP pbx_stage_latency_max_us Longest time spent in each stage.\n"
+		"# TYPE pbx_stage_latency_max_us gauge\n");
+	for (int s = 0; s < LATENCY_STAGES; s++) {
+		APPEND("pbx_stage_latency_max_us{stage=\"%s\"} %llu\n", stageName[s],
+			(unsigned long long) __atomic_load_n(&latencyHist[s].max, __ATOMIC_RELAXED));
+	}
+#undef APPEND
+
+	return (len < size) ? len : size - 1;
+}
@@ -0,0 +1,97 @@
+/* latency.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Per-stage frame latency histograms.  Each frame is timestamped when its
+ * first record's magic word arrives, at the end of its last channel
+ * record and at DRAW_ALL, and the transform thread notes when it starts
+ * publishing and when each output has been sent.  The time each stage
+ * took goes into its own histogram.  UDP requests get two more, timing
+ * each request to its reply for clients waiting on the next frame and
+ * for immediate requests answered from the latest one.
+ *
+ * The histograms are HDR style: exact to the microsecond up to 128us,
+ * then 64 linear steps per power of two (within about 1.5%) up to 2^32us
+ * (about 71 minutes), in a fixed 14K of counters.  Anything longer is
+ * counted in the last one.  Recording is a shift, a count
+ * leading zeros and a couple of stores, with no allocation or locking.
+ * Like the metrics, each histogram has one writing thread, and readers
+ * just take a slightly stale look.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __latency_h__
+#define __latency_h__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define HIST_EXACT   128                  // values below this get their own counter
+#define HIST_STEPS   64                   // counters per power of two above that
+#define HIST_RANGES  25                   // powers of two covered, 2^7 to 2^32 us
+#define HIST_SLOTS   (HIST_EXACT + HIST_RANGES * HIST_STEPS)
+
+enum LatencyStage {
+  STAGE_RECEIVE = 0,                      // first magic word -> end of last channel record
+  STAGE_DRAW,                             // end of last channel record -> DRAW_ALL
+  STAGE_HANDOFF,                          // DRAW_ALL -> transform thread starts publishing
+  STAGE_SHM,                              // publishing starts -> frame in shared memory ring
+  STAGE_UNIX,                             //   -> sent to unix socket clients
+  STAGE_PIPE,                             //   -> written to video output
+  STAGE_RASTER,                           //   -> image drawn and written
+  STAGE_UDP,                              //   -> sent to UDP clients
+  STAGE_TOTAL,                            // first magic word -> last send
+  STAGE_UDP_NEXT,                         // UDP request -> reply with the next frame
+  STAGE_UDP_NOW,                          // UDP request -> reply with the latest frame
+  LATENCY_STAGES
+};
+
+typedef struct {
+    uint64_t count[HIST_SLOTS];
+    uint64_t total;                       // values recorded
+    uint64_t sum;                         // of all values, in us
+    uint64_t max;
+} histogram;
+
+extern histogram latencyHist[LATENCY_STAGES];
+
+static inline uint64_t latencyNow(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// counter for a value in us
+static inline int histogramSlot(uint64_t us) {
+	int shift;
+
+	if (us < HIST_EXACT) return (int) us;
+	if (us >> (HIST_RANGES + 7)) return HIST_SLOTS - 1;
+
+	shift = 63 - __builtin_clzll(us) - 6;   // leaves us >> shift in 64..127
+	return HIST_EXACT + (shift - 1) * HIST_STEPS + (int) (us >> shift) - HIST_STEPS;
+}
+
+// record the time between two latencyNow() stamps.  Only one thread may
+// record to a given stage.
+static inline void latencyRecord(int stage, uint64_t from, uint64_t to) {
+	histogram *h = &latencyHist[stage];
+	uint64_t us = (to - from) / 1000;
+	uint64_t *c = &h->count[histogramSlot(us)];
+
+	__atomic_store_n(c, *c + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->total, h->total + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->sum, h->sum + us, __ATOMIC_RELAXED);
+	if (us > h->max) __atomic_store_n(&h->max, us, __ATOMIC_RELAXED);
+}
+
+uint64_t histogramPercentile(const histogram *h, double pct);
+void latencyDump(FILE *f);
+size_t latencyFormat(char *buf, size_t size);
+
+#endif /* __latency_h__ */
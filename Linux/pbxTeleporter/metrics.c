@@ -0,0 +1,196 @@
+/* metrics.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Per-thread counters and the Prometheus HTTP listener.  See metrics.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "latency.h"
+#include "perfCounters.h"
+#include "pbxTeleporter.h"
+
+#define METRICS_POLL_MS 250               // how often the listener checks for shutdown
+#define METRICS_TIMEOUT_S 1               // give up on a client that doesn't send its request
+#define METRICS_BODY_SIZE 16384
+
+metricBlock metricBlocks[METRIC_THREADS];
+__thread metricBlock *threadMetrics = &metricBlocks[METRIC_THREAD_OTHER];
+
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+} metricInfo[METRIC_COUNT] = {
+	[M_SERIAL_BYTES]     = {"pbx_serial_bytes_total", "counter", "Bytes read from the serial port."},
+	[M_RESYNCS]          = {"pbx_serial_resyncs_total", "counter", "Times the serial stream lost framing and was searched for the next UPXL."},
+	[M_RECORDS]          = {"pbx_channel_records_total", "counter", "Channel records read."},
+	[M_CRC_FAILURES]     = {"pbx_crc_failures_total", "counter", "Channel records with a bad CRC."},
+	[M_SERIAL_STALLS]    = {"pbx_serial_stalls_total", "counter", "Times the serial stream stalled or turned to garbage and was reset."},
+	[M_UART_OVERRUNS]    = {"pbx_uart_overruns_total", "counter", "Characters lost to UART FIFO overruns."},
+	[M_UART_FRAMING]     = {"pbx_uart_framing_errors_total", "counter", "UART framing errors."},
+	[M_UART_PARITY]      = {"pbx_uart_parity_errors_total", "counter", "UART parity errors."},
+	[M_UART_BREAKS]      = {"pbx_uart_breaks_total", "counter", "Breaks seen on the serial line."},
+	[M_UART_BUFFER_OVERRUNS] = {"pbx_uart_buffer_overruns_total", "counter", "Characters lost because the tty buffer was full."},
+	[M_FRAMES_RECEIVED]  = {"pbx_frames_received_total", "counter", "Frames received (DRAW_ALL commands)."},
+	[M_FRAMES_SKIPPED]   = {"pbx_frames_skipped_total", "counter", "Frames replaced by a newer one before they could be published."},
+	[M_FRAMES_PUBLISHED] = {"pbx_frames_published_total", "counter", "Frames sent to the outputs."},
+	[M_FRAMES_DEDUPED]   = {"pbx_frames_deduplicated_total", "counter", "Unchanged frames not sent."},
+	[M_FRAMES_IDLE]      = {"pbx_frames_idle_total", "counter", "Frames skipped without decoding because nobody was listening."},
+	[M_UDP_REQUESTS]     = {"pbx_udp_requests_total", "counter", "Frame requests from UDP clients."},
+	[M_UDP_SENDS]        = {"pbx_udp_sends_total", "counter", "Frames sent to UDP clients."},
+	[M_UDP_SEND_ERRORS]  = {"pbx_udp_send_errors_total", "counter", "Failed UDP sends."},
+	[M_UDP_BYTES_SENT]   = {"pbx_udp_sent_bytes_total", "counter", "Bytes sent to UDP clients."},
+	[M_UNIX_SENDS]       = {"pbx_unix_sends_total", "counter", "Frames sent to unix socket clients."},
+	[M_UNIX_DROPS]       = {"pbx_unix_dropped_total", "counter", "Frames unix socket clients missed, because they were too slow or the frame was too big."},
+	[M_PIPE_FRAMES]      = {"pbx_pipe_frames_total", "counter", "Frames written to video outputs."},
+	[M_PIPE_DROPS]       = {"pbx_pipe_dropped_total", "counter", "Frames video readers were too slow to take."},
+	[M_HTTP_REQUESTS]    = {"pbx_metrics_requests_total", "counter", "Requests to this endpoint."},
+	[M_UDP_CLIENTS]      = {"pbx_udp_clients", "gauge", "UDP clients answered with the last frame."},
+	[M_UNIX_CLIENTS]     = {"pbx_unix_clients", "gauge", "Connected unix socket clients."},
+	[M_FRAME_PIXELS]     = {"pbx_frame_pixels", "gauge", "Pixels in the last frame published."},
+	[M_SERIAL_RECOVERY_MS] = {"pbx_serial_recovery_ms", "gauge", "After the last stall, time from data resuming to the first complete frame."},
+};
+
+void *metricsListener(void *arg);
+
+// point the calling thread's updates at its own block
+void metricsThread(int thread) {
+	threadMetrics = &metricBlocks[thread];
+}
+
+// add up one metric across all threads
+uint64_t metricRead(int m) {
+	uint64_t total = 0;
+
+	for (int t = 0; t < METRIC_THREADS; t++) {
+		total += __atomic_load_n(&metricBlocks[t].value[m], __ATOMIC_RELAXED);
+	}
+	return total;
+}
+
+// Prometheus text exposition format.  Returns the length of the text.
+static size_t formatMetrics(char *buf, size_t size) {
+	size_t len = 0;
+
+	for (int m = 0; m < METRIC_COUNT && len < size; m++) {
+		len += snprintf(buf + len, size - len, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+			metricInfo[m].name, metricInfo[m].help, metricInfo[m].name, metricInfo[m].type,
+			metricInfo[m].name, (unsigned long long) metricRead(m));
+	}
+	if (len < size) len += latencyFormat(buf + len, size - len);
+	if (len < size) len += perfFormat(buf + len, size - len);
+	return (len < size) ? len : size - 1;
+}
+
+metricsServer *createMetricsServer(const char *bind_addr, int port) {
+	metricsServer *ms;
+	int options = 1;
+
+	ms = (metricsServer *) calloc(1, sizeof(metricsServer));
+	ms->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (ms->fd < 0) {
+		printf("pbxTeleporter: ERROR opening metrics socket\n");
+		free(ms);
+		return NULL;
+	}
+	setsockopt(ms->fd, SOL_SOCKET, SO_REUSEADDR, &options, sizeof(options));
+
+	ms->addr.sin_family = AF_INET;
+	ms->addr.sin_port = htons((unsigned short) port);
+	if (strlen(bind_addr) == 0) {
+		ms->addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	}
+	else {
+		inet_aton(bind_addr, &ms->addr.sin_addr);
+	}
+
+	if ((bind(ms->fd, (struct sockaddr *) &ms->addr, sizeof(ms->addr)) < 0) || (listen(ms->fd, 8) < 0)) {
+		printf("pbxTeleporter: Bind metrics port %d failed: %s\n", port, strerror(errno));
+		close(ms->fd);
+		free(ms);
+		return NULL;
+	}
+
+	pthread_create(&ms->pt, NULL, &metricsListener, (void *) ms);
+	return ms;
+}
+
+void destroyMetricsServer(metricsServer *ms) {
+	if (ms == NULL) return;
+
+	pthread_join(ms->pt, NULL);
+	close(ms->fd);
+	free(ms);
+}
+
+// read the request line and answer it.  Anything but GET /metrics (or /)
+// gets a 404.
+static void answerClient(int fd) {
+	static char body[METRICS_BODY_SIZE];
+	char req[1024], header[256], path[256];
+	struct timeval tv = { METRICS_TIMEOUT_S, 0 };
+	size_t have = 0, bodyLen;
+	int n;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	while (have < sizeof(req) - 1) {
+		n = recv(fd, req + have, sizeof(req) - 1 - have, 0);
+		if (n <= 0) break;
+		have += n;
+		req[have] = 0;
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+	}
+	req[have] = 0;
+
+	if ((sscanf(req, "GET %255s", path) == 1) && ((strcmp(path, "/metrics") == 0) || (strcmp(path, "/") == 0))) {
+		metricAdd(M_HTTP_REQUESTS, 1);
+		bodyLen = formatMetrics(body, sizeof(body));
+		n = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", bodyLen);
+	}
+	else {
+		bodyLen = 0;
+		n = snprintf(header, sizeof(header), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+	}
+
+	if (send(fd, header, n, MSG_NOSIGNAL) == n && bodyLen) {
+		send(fd, body, bodyLen, MSG_NOSIGNAL);
+	}
+}
+
+// Metrics listener thread.  One client at a time is plenty for a scraper.
+void *metricsListener(void *arg) {
+	metricsServer *ms = (metricsServer *) arg;
+	struct pollfd pfd;
+	int fd;
+
+	metricsThread(METRIC_THREAD_HTTP);
+
+	while (runFlag) {
+		pfd.fd = ms->fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, METRICS_POLL_MS) <= 0) continue;
+
+		fd = accept4(ms->fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) continue;
+		answerClient(fd);
+		close(fd);
+	}
+
+	pthread_exit(NULL);
+}
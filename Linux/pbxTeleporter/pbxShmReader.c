@@ -0,0 +1,149 @@
+/* pbxShmReader.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Reader library for the pbxTeleporter shared memory frame ring.
+ * See pbxShmReader.h for usage.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "pbxShmReader.h"
+
+#define ACQUIRE_RETRIES 8
+
+pbxShmReader *pbxShmOpen(const char *name) {
+	pbxShmReader *r;
+	int fd;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) return NULL;
+
+	r = pbxShmOpenFd(fd);
+	if (r == NULL) close(fd);
+	return r;
+}
+
+pbxShmReader *pbxShmOpenFd(int fd) {
+	pbxShmReader *r;
+	struct stat st;
+	void *p;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(shmRingHeader)) {
+		return NULL;
+	}
+
+// mapped read/write only so we can use the futex and reader count words.
+	p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+
+	if (__atomic_load_n(&((shmRingHeader *) p)->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC ||
+		((shmRingHeader *) p)->version != SHM_RING_VERSION) {
+		munmap(p, st.st_size);
+		return NULL;
+	}
+
+	r = (pbxShmReader *) calloc(1, sizeof(pbxShmReader));
+	r->fd = fd;
+	r->mapSize = st.st_size;
+	r->hdr = (const shmRingHeader *) p;
+	r->lastSeq = 0;
+	__atomic_add_fetch((uint32_t *) &r->hdr->readers, 1, __ATOMIC_RELAXED);
+
+	return r;
+}
+
+int pbxShmWait(pbxShmReader *r, int timeout_ms) {
+	uint32_t *futex = (uint32_t *) &r->hdr->futex;
+	uint32_t *waiters = (uint32_t *) &r->hdr->waiters;
+	struct timespec ts, *pts = NULL;
+	uint32_t val;
+	int res;
+
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		pts = &ts;
+	}
+
+	// count ourselves as a waiter before looking for a frame, so the
+	// writer either sees us and wakes us, or has already bumped the futex
+	// word and FUTEX_WAIT returns at once.  Pairs with shmRingPublish().
+	for (;;) {
+		__atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+		val = __atomic_load_n(futex, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&r->hdr->frameSeq, __ATOMIC_ACQUIRE) != r->lastSeq) {
+			__atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+			return 1;
+		}
+
+		res = syscall(SYS_futex, futex, FUTEX_WAIT, val, pts, NULL, 0);
+		__atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+
+		if (res < 0) {
+			if (errno == ETIMEDOUT) return 0;
+			if (errno != EAGAIN && errno != EINTR) return -1;
+		}
+	}
+}
+
+int pbxShmAcquire(pbxShmReader *r, pbxShmFrame *f) {
+	const shmRingHeader *hdr = r->hdr;
+	const shmSlotHeader *slot;
+	uint64_t frameSeq;
+	uint32_t seq;
+
+	for (int i = 0; i < ACQUIRE_RETRIES; i++) {
+		frameSeq = __atomic_load_n(&hdr->frameSeq, __ATOMIC_ACQUIRE);
+		if (frameSeq == 0) return 0;
+
+		slot = shmSlot(hdr, frameSeq % hdr->slotCount);
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) continue;
+
+		f->slot = slot;
+		f->seq = seq;
+		f->data = shmSlotData(hdr, slot);
+		f->directory = shmSlotDirectory(slot);
+		f->channelCount = hdr->channelCount;
+		f->length = slot->length;
+		f->frameSeq = slot->frameSeq;
+		f->timestamp = slot->timestamp;
+
+		if (f->frameSeq == frameSeq && pbxShmValidate(r, f)) {
+			r->lastSeq = frameSeq;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int pbxShmValidate(pbxShmReader *r, const pbxShmFrame *f) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&f->slot->seq, __ATOMIC_RELAXED) == f->seq;
+}
+
+void pbxShmClose(pbxShmReader *r) {
+	if (r == NULL) return;
+
+	__atomic_sub_fetch((uint32_t *) &r->hdr->readers, 1, __ATOMIC_RELAXED);
+	munmap((void *) r->hdr, r->mapSize);
+	close(r->fd);
+	free(r);
+}
@@ -0,0 +1,76 @@
+/* pbxShmReader.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Reader library for the pbxTeleporter shared memory frame ring.  Lets a
+ * program on the same machine as the bridge map the ring and read frames
+ * in place, without copying them out.  Typical use:
+ *
+ *   pbxShmReader *r = pbxShmOpen("/pbxTeleporter");
+ *   pbxShmFrame f;
+ *   while (pbxShmWait(r, 1000) >= 0) {
+ *       if (pbxShmAcquire(r, &f)) {
+ *           ... use f.data, f.length, f.directory ...
+ *           if (!pbxShmValidate(r, &f)) { frame was overwritten, discard results }
+ *       }
+ *   }
+ *   pbxShmClose(r);
+ *
+ * The ring is mapped read/write, since readers update the futex, waiter
+ * and reader count words.  The bridge creates it with group read/write
+ * permission, so run consumers as the bridge's user or in its group.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __pbxshmreader_h__
+#define __pbxshmreader_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "shmRing.h"
+
+typedef struct _pbxShmReader {
+    int fd;
+    size_t mapSize;
+    const shmRingHeader *hdr;
+    uint64_t lastSeq;                     // last frame returned by pbxShmAcquire
+} pbxShmReader;
+
+// a frame, as seen in place in the ring
+typedef struct {
+    const uint8_t *data;                  // pixel data, each channel's bytes per pixel in its
+                                          // directory entry (3 for RGB, 4 for RGBW)
+    const channelEntry *directory;        // where each channel lives in data
+    uint32_t channelCount;                // entries in directory
+    uint32_t length;                      // bytes of pixel data
+    uint64_t frameSeq;                    // frame sequence number
+    uint64_t timestamp;                   // CLOCK_MONOTONIC nanoseconds at publish
+    const shmSlotHeader *slot;
+    uint32_t seq;                         // slot seqlock value at acquire time
+} pbxShmFrame;
+
+// open and map an existing ring.  Returns NULL if the bridge isn't running.
+pbxShmReader *pbxShmOpen(const char *name);
+
+// attach to a ring given an open file descriptor, such as the memfd
+// handed out by the bridge's unix socket server.  The reader takes
+// ownership of fd.
+pbxShmReader *pbxShmOpenFd(int fd);
+
+// wait up to timeout_ms (-1 = forever) for a frame newer than the last one
+// acquired.  Returns 1 if a new frame is ready, 0 on timeout, -1 on error.
+int pbxShmWait(pbxShmReader *r, int timeout_ms);
+
+// point f at the newest frame.  Returns 1 on success, 0 if no frame
+// has been published yet or the writer kept lapping us.
+int pbxShmAcquire(pbxShmReader *r, pbxShmFrame *f);
+
+// returns 1 if the frame was not overwritten while it was being read.
+int pbxShmValidate(pbxShmReader *r, const pbxShmFrame *f);
+
+void pbxShmClose(pbxShmReader *r);
+
+#endif /* __pbxshmreader_h__ */
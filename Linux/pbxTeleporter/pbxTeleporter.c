@@ -3,8 +3,8 @@
  * Serial -> UDP Bridge for Pixelblaze
  * Linux/Raspberry Pi version
  *
- * Reads data from a Pixelblaze by emulating a single (8 channel, 2048 pixel) output expander
- * board and forwards it over the network via UDP datagram on request.  The wire protocol is
+ * Reads data from a Pixelblaze by emulating up to 8 (8 channel) output expander boards
+ * and forwards it over the network via UDP datagram on request.  The wire protocol is
  * described in Ben Hencke's Pixelblaze Output Expander board repository at:
  * https://github.com/simap/pixelblaze_output_expander
  *
@@ -12,31 +12,100 @@
  * 2021 by JEM (ZRanger1)
  * Distributed under the MIT license
 */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <signal.h>
 #include <sched.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "pbxTeleporter.h"
 #include "pbxSerial.h"
 #include "udpServer.h"
+#include "shmRing.h"
+#include "unixServer.h"
+#include "pipeOutput.h"
+#include "frameStore.h"
+#include "frameArena.h"
+#include "pixelKernels.h"
+#include "colorCorrect.h"
+#include "pixelRemap.h"
+#include "pixelRaster.h"
+#include "frameQueue.h"
+#include "metrics.h"
+#include "latency.h"
+#include "trace.h"
+#include "perfCounters.h"
+#include "probes.h"
 #include "cmdline.h"
 
-// TODO -- per channel buffers for virtual wiring
-// TODO -- support color order, again for virtual wiring
-// TODO -- support extra APA brightness bits on HDR monitors?
-
 // Global variables -- handles, buffers and pointers
 int serialHandle = -1;                  // file descriptor for active serial device.
 udpServer *udp;                         // network server object
-uint8_t pixel_buffer[BUFFER_SIZE];      // per-pixel RGB data for current frame
-uint8_t *pixel_ptr;                     // current write position in buffer
-uint16_t pixelsReady;                   // number of pixels if frame is ready, 0 otherwise
-int runFlag;                            // run status - 1 = keep running, 0 = shutdown
-int clientRequestFlag = 0;              // non-zero indicates pending request from client
+shmRing *shm = NULL;                    // shared memory frame ring, if enabled
+unixServer *local = NULL;               // unix domain socket server, if enabled
+pipeOutput *video = NULL;               // raw video output, if enabled
+metricsServer *metrics = NULL;          // Prometheus endpoint, if enabled
+frameArena *arena = NULL;               // memory for all of the buffers below
+uint8_t *pixel_buffer;                  // per-pixel RGB data for current frame
+frameStore frame;                       // per-channel layout of pixel_buffer
+uint8_t *ingest_buffer;                 // raw channel data that needs converting
+size_t ingestSize;                      // bytes in ingest_buffer
+uint8_t *brightness_buffer;             // per-pixel APA102 brightness
+uint16_t *hdr_buffer;                   // 16 bit per element frame, built on request
+size_t hdrSize = 0;                     // bytes in hdr_buffer for the current frame, 0 until built
+const frameStore *hdrFrom = NULL;       // the frame hdr_buffer was built from
+uint8_t *folded_buffer;                 // RGBW folded to RGB, for clients that ask
+frameStore folded;                      // layout of folded_buffer
+const frameStore *foldedFrom = NULL;    // the frame folded was built from
+bool foldedRgbw = false;                // that frame had RGBW channels to fold
+colorCorrector *corrector = NULL;       // server side color correction, if enabled
+uint8_t *corrected_buffer;              // color corrected copy of the current frame
+frameStore corrected;                   // layout of corrected_buffer
+bool correctedReady = false;            // corrected is up to date with the current frame
+volatile int reloadFlag = 0;            // non-zero if the correction file should be reread
+volatile int dumpFlag = 0;              // non-zero if latency and perf stats should be printed
+pixelRemap *remapper = NULL;            // strip order to logical order, if enabled
+uint8_t *remapped_buffer;               // remapped copy of the output frame
+frameStore remapped;                    // layout of remapped_buffer
+bool remappedReady = false;             // remapped is up to date with the current frame
+pixelRaster *raster = NULL;             // frames drawn as images, if enabled
+pipeOutput *rasterVideo = NULL;         // where the images go
+frameQueue queue;                       // completed frames, serial thread to transform thread
+pthread_t transformPt;                  // transform thread
+const frameStore *current;              // frame the transform thread is publishing
+uint64_t publishedIdle = 0;             // idle frames counted when current was published
+uint32_t keepalive = 0;                 // ms between repeats of an unchanged frame, 0 = no dedup
+uint64_t lastHash;                      // hash of the last frame published
+uint64_t lastPublished = 0;             // when it went out, 0 if it has to go out anyway
+boardStats boards[MAX_BOARDS];          // per-board statistics
+uint64_t unroutable = 0;                // records for channels past the last board
+uint32_t magicCrc;                      // CRC-32 of "UPXL", where every record's CRC starts
+uint32_t recordCrc;                     // running CRC of the record being read
+int watchdog = 0;                       // serial watchdog timeout in ms, 0 to follow the frame rate
+uint64_t frameInterval = 0;             // recent time between DRAW_ALLs, in ns, peak held
+uint64_t lastDrawn = 0;                 // latencyNow() at the last DRAW_ALL
+uint64_t lastProgress;                  // getTickCount() at the last good record or DRAW_ALL
+bool stalled = false;                   // watchdog went off, the current record is abandoned
+bool streamStale = true;                // waiting for a frame, after a stall or at startup
+uint64_t resumed = 0;                   // latencyNow() when data started arriving again
+bool uartCounted = false;               // serial driver keeps line error counts
+serialErrorCounts uartBase;             // counts when we opened the port
+uint64_t lastErrorPoll = 0;             // latencyNow() when they were last read
+int sendCpu = -1;                       // CPU for the transform thread, -1 for any
+bool lazyIngest = true;                 // don't decode frames nobody is listening for
+bool ingestIdle = false;                // nobody was listening when this frame started
+volatile uint32_t pixelsReady;          // bytes in frame if frame is ready, 0 otherwise
+volatile int runFlag;                   // run status - 1 = keep running, 0 = shutdown
+volatile int clientRequestFlag = 0;     // non-zero indicates pending request from client
+int rgbwMode = RGBW_CONVERT;            // what to do with 4 element WS2812 channels
 
 /////////////////////////////////
 // Utility Functions
@@ -55,19 +124,102 @@ uint64_t getTickCount() {
 	return ticks;
 }
 
+// pin the calling thread to one CPU.  Threads it starts afterwards
+// inherit the pinning.
+void pinThread(const char *name, int cpu) {
+	cpu_set_t set;
+	int err;
+
+	if (cpu < 0) return;
+	if (cpu >= CPU_SETSIZE) {
+		printf("pbxTeleporter: unable to pin %s thread to CPU %i: no such CPU\n",name,cpu);
+		return;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu,&set);
+	err = pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+	if (err) printf("pbxTeleporter: unable to pin %s thread to CPU %i: %s\n",name,cpu,strerror(err));
+}
+
+// run the calling thread under SCHED_FIFO, so it gets the CPU the moment
+// serial data arrives instead of waiting its turn behind whatever else is
+// running.  Threads it starts afterwards inherit the policy.
+void setRealtime(int priority) {
+	struct sched_param sp;
+	int err;
+
+	if (priority == 0) return;
+
+	sp.sched_priority = priority;
+	err = pthread_setschedparam(pthread_self(),SCHED_FIFO,&sp);
+	if (err) printf("pbxTeleporter: unable to use real-time scheduling: %s\n",strerror(err));
+}
+
+// how long the serial stream can go quiet, or make no sense, before the
+// watchdog resets it.  Half again the longest recent gap between frames,
+// unless --watchdog sets it.  -1 (off) waits forever.
+int watchdogTimeout() {
+	int ms;
+
+	if (watchdog) return watchdog;
+	if (frameInterval == 0) return WATCHDOG_MAX_MS;
+
+	ms = (int) (frameInterval * 3 / 2 / 1000000);
+	if (ms < WATCHDOG_MIN_MS) return WATCHDOG_MIN_MS;
+	return (ms > WATCHDOG_MAX_MS) ? WATCHDOG_MAX_MS : ms;
+}
+
+// read whatever has arrived, up to size bytes, waiting for it if there's
+// nothing yet.  Returns the number of bytes read, or 0 if the watchdog
+// went off or we're shutting down.
+int readSerial(uint8_t *buf, uint32_t size) {
+	int n;
+
+	while (runFlag && !stalled) {
+		n = serialGetbytes(serialHandle,buf,size);
+		if (n > 0) {
+			metricAdd(M_SERIAL_BYTES,n);
+			if (streamStale && !resumed) resumed = latencyNow();
+			return n;
+		}
+
+		// once we've reset, just wait for the stream to come back
+		switch (serialWait(serialHandle,streamStale ? WATCHDOG_MAX_MS : watchdogTimeout())) {
+		case 0:
+			if (!streamStale) stalled = true;
+			break;
+		case -1:
+			// adapter unplugged, or a pty with nobody on the other end
+			if (!streamStale && watchdog != WATCHDOG_OFF) stalled = true;
+			usleep(SERIAL_RETRY_MS * 1000);
+			break;
+		}
+	}
+	return 0;
+}
+
 //
-// Reads the specified number of bytes into a buffer
-void readBytes(uint8_t *buf, uint16_t size) {
+// Reads the specified number of bytes into a buffer.  read() hands
+// back whatever has arrived so far, so we ask for everything that's
+// left and loop 'till we have it.  Gives up if the stream stalls, so
+// callers should check stalled before using what they asked for.
+void readBytes(uint8_t *buf, uint32_t size) {
+	int n;
 
-	for (int i = 0; i < size ;i++) {
-	  serialGetbyte(serialHandle,buf++);
+	while (size) {
+		n = readSerial(buf,size);
+		if (n == 0) return;
+		recordCrc = crc32Update(recordCrc,buf,n);
+		buf += n;
+		size -= n;
 	}
 }
 
 // read a single byte from the serial device
 uint8_t readOneByte() {
-	uint8_t b;
-	serialGetbyte(serialHandle,&b);
+	uint8_t b = 0;
+	readSerial(&b,1);
 	return b;
 }
 
@@ -80,79 +232,582 @@ bool readMagicWord() {
 	if (readOneByte() != 'X') return false;
 	if (readOneByte() != 'L') return false;
 
+	recordCrc = magicCrc;
+	PROBE1(magic,frame.sequence);
 	return true;
 }
 
+// read and throw away size bytes without looking at them, as much at a
+// time as ingest_buffer holds
+void discardBytes(uint32_t size) {
+	while (size) {
+		int n = readSerial(ingest_buffer,(size < ingestSize) ? size : ingestSize);
+		if (n == 0) return;
+		size -= n;
+	}
+}
+
+// true if anybody wants the frame that's starting: an output that takes
+// every frame, a unix socket client, or a UDP client that has asked for
+// one lately
+bool anyoneListening() {
+	uint64_t lastRequest;
+
+	if (!lazyIngest || (shm != NULL) || (video != NULL) || (raster != NULL)) return true;
+	if ((local != NULL) && (__atomic_load_n(&local->clientCount,__ATOMIC_RELAXED) > 0)) return true;
+	if (clientRequestFlag) return true;
+
+	lastRequest = __atomic_load_n(&udp->lastRequest,__ATOMIC_RELAXED);
+	return lastRequest && (latencyNow() - lastRequest < UDP_ACTIVE_MS * 1000000ULL);
+}
+
+// read and discard data we have no room for
+void skipBytes(uint32_t size) {
+	uint8_t discard[256];
+
+	while (size) {
+		uint32_t n = (size > sizeof(discard)) ? sizeof(discard) : size;
+		readBytes(discard,n);
+		size -= n;
+	}
+}
+
 // crcCheck()
-// read and discard 32-bit CRC from data buffer 
-void crcCheck() { 
-	uint32_t crc;
+// read the 32-bit CRC at the end of a channel record and compare it with
+// the CRC of everything since the magic word.  The expander throws a bad
+// record away; we keep it, since a glitched frame beats a stale one for
+// a preview, and count it so it shows up in the metrics.
+void crcCheck(uint8_t channel) {
+	uint32_t crc, expected = recordCrc ^ CRC32_INIT;
+
 	readBytes((uint8_t *) &crc,sizeof(crc));
+	if (stalled) return;
+	if (crc != expected) {
+		metricAdd(M_CRC_FAILURES,1);
+		PROBE2(crc_error,frame.sequence,channel);
+	}
+	else {
+		lastProgress = getTickCount();
+	}
+}
+
+// update statistics for the board a channel record was addressed to
+void countRecord(uint8_t channel, uint16_t pixels, uint32_t bytes, bool stored) {
+	boardStats *b;
+
+	metricAdd(M_RECORDS,1);
+	PROBE5(record,frame.sequence,channel,pixels,bytes,stored);
+	if (channel >= MAX_CHANNELS) {
+		unroutable++;
+		return;
+	}
+
+	b = &boards[channel / CHANNELS_PER_BOARD];
+	b->records++;
+	b->channels |= 1 << (channel % CHANNELS_PER_BOARD);
+	if (stored) {
+		b->pixels += pixels;
+	}
+	else {
+		b->skipped++;
+	}
+}
+
+// skip a channel record's pixels and CRC while idle.  The channel still
+// counts as received for the board stats.
+void idleRecord(uint8_t channel, uint16_t pixels, uint32_t bytes) {
+	countRecord(channel,pixels,bytes,true);
+	if (channel < MAX_CHANNELS) frame.received |= (1ULL << channel);
+	discardBytes(bytes + sizeof(uint32_t));
+}
+
+void printBoardStats() {
+	for (int i = 0; i < MAX_BOARDS; i++) {
+		boardStats *b = &boards[i];
+		if (b->records == 0) continue;
+
+		printf("    Board %i: %llu frames, %llu records, %llu pixels, %llu skipped, channels 0x%02x\n", i,
+			(unsigned long long) b->frames, (unsigned long long) b->records,
+			(unsigned long long) b->pixels, (unsigned long long) b->skipped, b->channels);
+	}
+	if (unroutable) {
+		printf("    %llu records for channels past board %i\n", (unsigned long long) unroutable, MAX_BOARDS - 1);
+	}
 }
 
 /////////////////////////////////
 // Command Handlers
 /////////////////////////////////
 
-// read pixel data in WS2812 format
-// NOTE: Only handles 3 byte RGB data for now.  Discards frame
-// if it's any other size.
-void doSetChannelWS2812() {
+// read pixel data in WS2812 format into the channel's slot.  RGBW
+// data is either converted to RGB or kept as RGBW, depending on
+// rgbwMode.  Discards channels with any other
+// number of elements.  Data that's kept as it arrives is read straight
+// into the slot; only RGBW to RGB needs a pass over the pixels.
+void doSetChannelWS2812(uint8_t channel) {
 	PBWS2812Channel ch;
-	uint16_t data_length;
+	uint8_t *dst = NULL;
+	uint8_t elements;
+	uint64_t t;
 
 	readBytes((uint8_t *) &ch,sizeof(ch));
+	if (stalled) return;
+	if (ingestIdle) {
+		idleRecord(channel,ch.pixels,ch.pixels * ch.numElements);
+		return;
+	}
+
+	// find room for pixel data if available
+	elements = ((ch.numElements == 4) && (rgbwMode == RGBW_CONVERT)) ? 3 : ch.numElements;
+	if ((ch.numElements == 3) || (ch.numElements == 4)) {
+		dst = frameStoreChannel(&frame,channel,ch.pixels,elements,PROTOCOL_WS2812);
+	}
+
+	countRecord(channel,ch.pixels,ch.pixels * ch.numElements,dst != NULL);
+	if (dst == NULL) {
+		skipBytes(ch.pixels * ch.numElements);
+		crcCheck(channel);
+		return;
+	}
+
+	if (elements == ch.numElements) {
+		t = TRACE_BEGIN();
+		readBytes(dst,ch.pixels * elements);
+		TRACE_END("serial read",t,channel);
+	}
+	else {
+		t = TRACE_BEGIN();
+		readBytes(ingest_buffer,ch.pixels * 4);
+		TRACE_END("serial read",t,channel);
 
-	// read pixel data if available
-	if (ch.pixels && (ch.numElements == 3) && (ch.pixels <= MAX_PIXELS)) {
-		data_length = ch.pixels * ch.numElements;
-		readBytes(pixel_ptr,data_length);
-		pixel_ptr += data_length;
+		t = TRACE_BEGIN();
+		rgbwToRgb(ingest_buffer,dst,ch.pixels);
+		TRACE_END("decode",t,channel);
 	}
 
-	crcCheck();
+	crcCheck(channel);
 }
 
-// read pixel data in APA 102 format
-void doSetChannelAPA102() {
+// read pixel data in APA 102 format into the channel's slot
+void doSetChannelAPA102(uint8_t channel) {
 	PBAPA102DataChannel ch;
+	uint8_t *dst = NULL;
+	uint64_t t;
 
 	readBytes((uint8_t *) &ch,sizeof(ch));
+	if (stalled) return;
+	if (ingestIdle) {
+		idleRecord(channel,ch.pixels,ch.pixels * 4);
+		return;
+	}
 
 	// APA 102 data is always four bytes. The first byte
 	// contains a 3 bit flag and 5 bits of "extra" brightness data.
-	// We're gonna discard the "extra" APA bits and put 3-byte RGB
-	// data into the output buffer.
-	if (ch.frequency && (ch.pixels <= MAX_PIXELS)) {
-		for (int i = 0; i < ch.pixels;i++) {
-			readOneByte();
-			readBytes(pixel_ptr,3);
-			pixel_ptr += 3;
-		}
+	// We read the whole channel at once, then put 3-byte RGB data into
+	// the output buffer and the "extra" APA bits into the brightness
+	// plane for HDR clients.
+	if (ch.frequency) {
+		dst = frameStoreChannel(&frame,channel,ch.pixels,3,PROTOCOL_APA102);
 	}
 
-	crcCheck();
+	countRecord(channel,ch.pixels,ch.pixels * 4,dst != NULL);
+	if (dst != NULL) {
+		t = TRACE_BEGIN();
+		readBytes(ingest_buffer,ch.pixels * 4);
+		TRACE_END("serial read",t,channel);
+
+		t = TRACE_BEGIN();
+		apa102ToRgb(ingest_buffer,dst,ch.pixels);
+		apa102Brightness(ingest_buffer,frameStoreBrightness(&frame,channel),ch.pixels);
+		TRACE_END("decode",t,channel);
+	}
+	else {
+		skipBytes(ch.pixels * 4);
+	}
+
+	crcCheck(channel);
+}
+
+// copy the UART's line error counts, since we opened the port, into the
+// metrics
+void pollSerialErrors() {
+	serialErrorCounts now;
+
+	if (!uartCounted || serialErrors(serialHandle,&now) < 0) return;
+
+	metricSet(M_UART_OVERRUNS,now.overrun - uartBase.overrun);
+	metricSet(M_UART_FRAMING,now.frame - uartBase.frame);
+	metricSet(M_UART_PARITY,now.parity - uartBase.parity);
+	metricSet(M_UART_BREAKS,now.brk - uartBase.brk);
+	metricSet(M_UART_BUFFER_OVERRUNS,now.bufOverrun - uartBase.bufOverrun);
+	lastErrorPoll = latencyNow();
+}
+
+// the watchdog went off.  Throw away whatever's buffered, go back to
+// hunting for a magic word, and hand over the frame we have with every
+// channel flagged stale, so clients can tell it isn't current.
+void recoverSerial() {
+	printf("pbxTeleporter: no usable serial data for %i ms, resetting\n", watchdogTimeout());
+
+	serialFlush(serialHandle);
+	stalled = false;
+	streamStale = true;
+	resumed = 0;
+	frame.started = 0;
+	frame.lastRecord = 0;
+	metricAdd(M_SERIAL_STALLS,1);
+	pollSerialErrors();
+
+	if (frame.length) {
+		frameStoreMarkStale(&frame);
+		frame.drawn = latencyNow();
+		frameQueuePut(&queue,&frame);
+		frame.sequence++;
+	}
 }
 
-// draw all pixels on all channels using current data
-// and transmits the current frame if there's a pending client request
+// draw all pixels on all channels using current data.  The completed
+// frame goes to the transform thread, which does everything else, so we
+// can get straight back to reading the serial port.
 void doDrawAll() {
-	pixelsReady = (pixel_ptr - pixel_buffer);
-	pixel_ptr = pixel_buffer;
-    if (clientRequestFlag) {
-      udpServerSend(udp,pixel_buffer,pixelsReady);
-      clientRequestFlag = 0;
-    }
+	uint64_t t = TRACE_BEGIN();
+
+	for (int i = 0; i < MAX_BOARDS; i++) {
+		if ((frame.received >> (i * CHANNELS_PER_BOARD)) & 0xff) boards[i].frames++;
+	}
+
+	frame.drawn = latencyNow();
+	if (frame.lastRecord) {
+		latencyRecord(STAGE_RECEIVE,frame.started,frame.lastRecord);
+		latencyRecord(STAGE_DRAW,frame.lastRecord,frame.drawn);
+	}
+
+	// the watchdog goes by the longest recent gap between frames.  It
+	// jumps up at once, so a slower pattern doesn't look like a stall
+	// every frame, and eases back down.
+	if (lastDrawn) {
+		uint64_t interval = frame.drawn - lastDrawn;
+		if (interval > WATCHDOG_MAX_MS * 1000000ULL) interval = WATCHDOG_MAX_MS * 1000000ULL;
+		if (interval > frameInterval) frameInterval = interval;
+		else frameInterval -= (frameInterval - interval) / 8;
+	}
+	lastDrawn = frame.drawn;
+	lastProgress = getTickCount();
+
+	if (streamStale) {
+		if (frame.sequence && resumed) {
+			metricSet(M_SERIAL_RECOVERY_MS,(frame.drawn - resumed) / 1000000);
+			printf("pbxTeleporter: serial stream back, first frame %.1f ms after data resumed\n",
+				(frame.drawn - resumed) / 1000000.0);
+		}
+		streamStale = false;
+	}
+	if (frame.drawn - lastErrorPoll >= SERIAL_ERROR_POLL_MS * 1000000ULL) pollSerialErrors();
+
+	metricAdd(M_FRAMES_RECEIVED,1);
+	perfSample(PERF_INGEST);
+	if (ingestIdle) {
+		// nobody to hand it to
+		metricAdd(M_FRAMES_IDLE,1);
+		frame.received = 0;
+	}
+	else {
+		frameStoreComplete(&frame);
+		PROBE3(draw_all,frame.sequence,frame.pixelCount,frame.length);
+		frameQueuePut(&queue,&frame);
+	}
+	frame.sequence++;
+
+	frame.started = 0;
+	frame.lastRecord = 0;
+	TRACE_END("draw all",t,-1);
 }
 
 // read APA 102 clock data.  
 // For now, we ignore this. Eventually, we may have to at least keep the
 // desired frequency for virtual wiring
-void doSetChannelAPA102Clock() {
+void doSetChannelAPA102Clock(uint8_t channel) {
 	PBAPA102ClockChannel ch;
 
 	readBytes((uint8_t *) &ch,sizeof(ch));
-	crcCheck();
+	crcCheck(channel);
+}
+
+/////////////////////////////////
+// Transform thread
+/////////////////////////////////
+
+// build the 16 bit per element version of fs, which is either the current
+// frame or the corrected and remapped one. APA102 channels are scaled by
+// their per-pixel brightness, everything else is treated as full
+// brightness.  The 8 bit values are widened as they are, so with gamma or
+// a correction LUT active the result is post-correction, not linear light;
+// clients that want the values as sent use PBX_REQUEST_RAW.  Returns size
+// in bytes.
+size_t buildHdrFrame(const frameStore *fs) {
+	uint64_t t = TRACE_BEGIN();
+
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		const channelEntry *e = &fs->dir[i];
+		if (e->length == 0) continue;
+
+		expandHdr(fs->data + e->offset,
+			(e->protocol == PROTOCOL_APA102) ? frameStoreBrightness((frameStore *) fs,i) : NULL,
+			hdr_buffer + e->offset, e->pixels, e->elements);
+	}
+	TRACE_END("encode hdr",t,-1);
+	return fs->length * sizeof(uint16_t);
+}
+
+// the frame as clients see it, after color correction and remapping.
+// Each stage runs the first time somebody asks for it each frame, and
+// everyone who wants transformed data shares the one copy.
+const frameStore *correctedFrame() {
+	if (corrector == NULL) return current;
+
+	if (!correctedReady) {
+		uint64_t t = TRACE_BEGIN();
+		colorCorrectFrame(corrector,current,&corrected,corrected_buffer);
+		correctedReady = true;
+		TRACE_END("correct",t,-1);
+	}
+	return &corrected;
+}
+
+const frameStore *outputFrame() {
+	if (remapper == NULL) return correctedFrame();
+
+	if (!remappedReady) {
+		const frameStore *src = correctedFrame();
+		uint64_t t = TRACE_BEGIN();
+		pixelRemapFrame(remapper,src,&remapped,remapped_buffer,current->capacity);
+		remappedReady = true;
+		TRACE_END("remap",t,-1);
+	}
+	return &remapped;
+}
+
+// src with RGBW channels folded to RGB, for PBX_REQUEST_RGB clients.
+// Built at most once per frame for each source, like the HDR frame.
+// Only passthrough mode keeps RGBW, so otherwise src is already RGB.
+const frameStore *foldedFrame(const frameStore *src) {
+	if (folded_buffer == NULL) return src;
+
+	if (foldedFrom != src) {
+		uint64_t t = TRACE_BEGIN();
+		if (hdrFrom == &folded) hdrSize = 0;
+		foldedRgbw = frameStoreFold(&folded,src,folded_buffer);
+		foldedFrom = src;
+		TRACE_END("fold rgbw",t,-1);
+	}
+	return foldedRgbw ? &folded : src;
+}
+
+// send the current frame to each client in requests, in the format each
+// client asked for: raw or transformed, RGBW folded or not, 8 or 16 bit.
+// The HDR frame is only built if somebody wants it, from the same frame
+// an 8 bit request with the same flags would get.
+void sendReplies(pendingRequest *requests, int n) {
+	for (int i = 0; i < n; i++) {
+		uint64_t t = TRACE_BEGIN();
+		const frameStore *src = (requests[i].flags & PBX_REQUEST_RAW) ? current : outputFrame();
+		int sent;
+
+		if (requests[i].flags & PBX_REQUEST_RGB) src = foldedFrame(src);
+
+		if (requests[i].format == FORMAT_RGB16) {
+			if (hdrSize == 0 || hdrFrom != src) {
+				hdrSize = buildHdrFrame(src);
+				hdrFrom = src;
+			}
+			sent = udpServerSend(udp,&requests[i].addr,(uint8_t *) hdr_buffer,hdrSize);
+		}
+		else {
+			sent = udpServerSend(udp,&requests[i].addr,src->data,src->length);
+		}
+		TRACE_END("udp send",t,i);
+		PROBE4(udp_send,current->sequence,requests[i].addr.sin_addr.s_addr,requests[i].format,sent);
+		latencyRecord((requests[i].flags & PBX_REQUEST_NOW) ? STAGE_UDP_NOW : STAGE_UDP_NEXT,
+			requests[i].received,latencyNow());
+	}
+}
+
+// answer every client that's waiting for the next frame
+void answerRequests() {
+	pendingRequest requests[MAX_PENDING_REQUESTS];
+	int n;
+
+	n = udpServerTakeRequests(udp,requests);
+	metricSet(M_UDP_CLIENTS,n);
+	sendReplies(requests,n);
+}
+
+// answer immediate requests from the frame we published last.  If the
+// serial thread has let frames go by undecoded since then, that frame is
+// out of date, and they wait for the next one like everybody else.
+void answerImmediate() {
+	pendingRequest requests[MAX_PENDING_REQUESTS];
+	uint64_t t = TRACE_BEGIN();
+	int n;
+
+	n = udpServerTakeImmediate(udp,requests);
+	if ((current == NULL) || (metricRead(M_FRAMES_IDLE) != publishedIdle)) {
+		for (int i = 0; i < n; i++) udpServerDefer(udp,&requests[i]);
+		return;
+	}
+	sendReplies(requests,n);
+	TRACE_END("immediate",t,n);
+}
+
+// true if fs is the same as the last frame published and it isn't time
+// to repeat it yet.  Everything downstream depends only on the frame, so
+// if it hasn't changed, there's nothing new to push to the outputs.
+bool frameUnchanged(const frameStore *fs) {
+	uint64_t t = TRACE_BEGIN();
+	uint64_t hash = frameStoreHash(fs), now = getTickCount();
+
+	TRACE_END("hash",t,-1);
+
+	if (lastPublished && (hash == lastHash) && (now - lastPublished < keepalive)) return true;
+
+	lastHash = hash;
+	lastPublished = now;
+	return false;
+}
+
+// send the current frame to the outputs that push every frame
+void pushFrame(uint64_t start) {
+	uint64_t t;
+
+	if (shm != NULL) {
+		const frameStore *out = outputFrame();
+		t = TRACE_BEGIN();
+		shmRingPublish(shm,out);
+		TRACE_END("shm",t,-1);
+		latencyRecord(STAGE_SHM,start,latencyNow());
+	}
+	if (local != NULL) {
+		unixServerPublish(local,outputFrame());
+		latencyRecord(STAGE_UNIX,start,latencyNow());
+	}
+	if (video != NULL) {
+		const frameStore *out = outputFrame();
+		t = TRACE_BEGIN();
+		pipeOutputWriteFrame(video,out);
+		TRACE_END("pipe write",t,-1);
+		latencyRecord(STAGE_PIPE,start,latencyNow());
+	}
+	if (raster != NULL) {
+		const uint8_t *image;
+		const frameStore *in = correctedFrame();
+		t = TRACE_BEGIN();
+		image = pixelRasterFrame(raster,in);
+		TRACE_END("rasterize",t,-1);
+		t = TRACE_BEGIN();
+		pipeOutputWrite(rasterVideo,image,raster->imageSize);
+		TRACE_END("raster write",t,-1);
+		latencyRecord(STAGE_RASTER,start,latencyNow());
+	}
+}
+
+// transform a completed frame and send it to all of our outputs, and to
+// any UDP client that's waiting for one.  A frame that's the same as the
+// last one isn't pushed again, but UDP clients asked for a frame and
+// still get one.
+void publishFrame(const frameStore *fs) {
+	uint64_t start = latencyNow();
+
+	current = fs;
+	publishedIdle = metricRead(M_FRAMES_IDLE);
+	correctedReady = false;
+	remappedReady = false;
+	hdrSize = 0;
+	foldedFrom = NULL;
+	latencyRecord(STAGE_HANDOFF,fs->drawn,start);
+
+	if (dumpFlag) {
+		latencyDump(stdout);
+		perfDump(stdout);
+		dumpFlag = 0;
+	}
+
+	if (reloadFlag) {
+		int changed = colorCorrectReload(corrector);
+		if (changed >= 0) printf("pbxTeleporter: reread correction file, %d channels changed\n", changed);
+		reloadFlag = 0;
+		lastPublished = 0;
+	}
+
+	if (keepalive && frameUnchanged(fs)) {
+		metricAdd(M_FRAMES_DEDUPED,1);
+	}
+	else {
+		metricAdd(M_FRAMES_PUBLISHED,1);
+		metricSet(M_FRAME_PIXELS,fs->pixelCount);
+		pushFrame(start);
+	}
+
+	pixelsReady = fs->length;
+	if (clientRequestFlag) {
+		clientRequestFlag = 0;
+		answerRequests();
+		latencyRecord(STAGE_UDP,start,latencyNow());
+	}
+
+	if (fs->started) latencyRecord(STAGE_TOTAL,fs->started,latencyNow());
+}
+
+// Transform thread function.  Publishes each frame the serial thread hands
+// over, skipping ahead to the newest if it falls behind, and answers
+// immediate UDP requests in between.
+void *transformThread(void *arg) {
+	frameStore *fs;
+	int woken;
+
+	metricsThread(METRIC_THREAD_TRANSFORM);
+	traceThread("transform");
+	pinThread("send",sendCpu);
+	perfThread(PERF_PUBLISH);
+	while (((fs = frameQueueTake(&queue,&woken)) != NULL) || woken) {
+		if (fs != NULL) {
+			uint64_t t = TRACE_BEGIN();
+			publishFrame(fs);
+			TRACE_END("publish",t,-1);
+			perfSample(PERF_PUBLISH);
+		}
+		if (woken) answerImmediate();
+	}
+
+	pthread_exit(NULL);
+}
+
+// carve the frame buffers out of one arena.  A frame is at most maxPixels
+// pixels of up to 4 bytes each, and no one channel can be bigger than
+// MAX_CHANNEL_PIXELS, which bounds the ingest buffer.
+bool allocateBuffers(const commandline *arguments) {
+	uint32_t maxPixels = arguments->max_pixels;
+	size_t frameBytes = (size_t) maxPixels * 4;
+	size_t channelBytes = (size_t) ((maxPixels < MAX_CHANNEL_PIXELS) ? maxPixels : MAX_CHANNEL_PIXELS) * 4;
+	size_t correctedBytes = arguments->correct_enabled ? frameBytes : 0;
+	size_t remappedBytes = (arguments->map_path != NULL) ? frameBytes : 0;
+	size_t foldedBytes = (arguments->rgbw_mode == RGBW_PASSTHROUGH) ? frameBytes : 0;
+	size_t queueBytes = FRAME_QUEUE_SLOTS * (frameBytes + maxPixels + 2 * ARENA_ALIGN);
+
+	arena = createFrameArena(frameBytes + channelBytes + maxPixels + frameBytes * sizeof(uint16_t) +
+		correctedBytes + remappedBytes + foldedBytes + queueBytes + 7 * ARENA_ALIGN, arguments->arena_flags);
+	if (arena == NULL) return false;
+
+	pixel_buffer = arenaAlloc(arena, frameBytes);
+	ingest_buffer = arenaAlloc(arena, channelBytes);
+	ingestSize = channelBytes;
+	brightness_buffer = arenaAlloc(arena, maxPixels);
+	hdr_buffer = arenaAlloc(arena, frameBytes * sizeof(uint16_t));
+	corrected_buffer = correctedBytes ? arenaAlloc(arena, correctedBytes) : NULL;
+	remapped_buffer = remappedBytes ? arenaAlloc(arena, remappedBytes) : NULL;
+	folded_buffer = foldedBytes ? arenaAlloc(arena, foldedBytes) : NULL;
+
+	frameStoreInit(&frame,pixel_buffer,frameBytes,brightness_buffer,maxPixels);
+	return (frameQueueInit(&queue,arena,frameBytes,maxPixels) == 0);
 }
 
 // Signal handling for clean shutdown
@@ -162,36 +817,152 @@ void pbxSignalHandler(int s){
      runFlag = 0;
 }
 
+// SIGHUP -- reread the correction file before the next frame
+void pbxReloadHandler(int s){
+     reloadFlag = 1;
+}
+
+// SIGUSR1 -- print latency stats before the next frame
+void pbxDumpHandler(int s){
+     dumpFlag = 1;
+}
+
 // setup
 // Get configuration from command line and intialize serial and
 // network communication
 bool setup(int argc, char *argv[]) {
 	commandline arguments;
 	struct sigaction sigIntHandler;
+	int actualBaud;
 
 // initialize and enable the main loop
 	runFlag = 1;
     clientRequestFlag = 0;
 	pixelsReady = 0;
-	pixel_ptr = pixel_buffer;
+	pixelKernelsInit();
+	magicCrc = crc32Update(CRC32_INIT,(const uint8_t *) "UPXL",4);
 
 // set defaults for parameters
 	arguments.serial_port = "";
 	arguments.listen_port = DEFAULT_LISTEN_PORT;
 	arguments.send_port = DEFAULT_SEND_PORT;
 	arguments.bind_ip = "";
+	arguments.shm_name = NULL;
+	arguments.shm_slots = SHM_DEFAULT_SLOTS;
+	arguments.unix_path = NULL;
+	arguments.pipe_path = NULL;
+	arguments.pipe_format = PIPE_FORMAT_RGB24;
+	arguments.pipe_width = 0;
+	arguments.pipe_height = 0;
+	arguments.pipe_fps = DEFAULT_PIPE_FPS;
+	arguments.rgbw_mode = RGBW_CONVERT;
+	arguments.max_pixels = DEFAULT_MAX_PIXELS;
+	arguments.arena_flags = 0;
+	arguments.correct_enabled = 0;
+	correctionDefaults(&arguments.correct);
+	arguments.correct_path = NULL;
+	arguments.map_path = NULL;
+	arguments.raster_path = NULL;
+	arguments.raster_width = DEFAULT_RASTER_SIZE;
+	arguments.raster_height = DEFAULT_RASTER_SIZE;
+	arguments.raster_mode = RASTER_NEAREST;
+	arguments.raster_out = NULL;
+	arguments.raster_format = PIPE_FORMAT_RGB24;
+	arguments.keepalive = 0;
+	arguments.metrics_port = 0;
+	arguments.trace_path = NULL;
+	arguments.perf = 0;
+	arguments.watchdog = 0;
+	arguments.baud = RCV_BITRATE;
+	arguments.rt_priority = 0;
+	arguments.ingest_cpu = -1;
+	arguments.send_cpu = -1;
+	arguments.mlockall = 0;
+	arguments.always_decode = 0;
 
 // parse cli arguments.
 	argp_parse(&argparser, argc, argv, 0, 0, &arguments);
 
+// keep status messages out of the video stream if it's going to stdout
+	if (((arguments.pipe_path != NULL) && (strcmp(arguments.pipe_path,"-") == 0)) ||
+		((arguments.raster_path != NULL) && (strcmp(arguments.raster_out,"-") == 0))) {
+		pipeSetStdout();
+	}
+
 	printf("pbxTeleporter v1.1.4 for Linux/Raspberry Pi\n");
 	printf("    Serial Device: %s\n", arguments.serial_port);
 	printf("    IP Address:    %s\n", (0 == strlen(arguments.bind_ip) ? "All" : arguments.bind_ip));
 	printf("    Listen Port:   %i", arguments.listen_port);
 	printf("    Send Port:     %i", arguments.send_port);
 	printf("\n");
+	printf("    Pixel Kernels: %s\n", pixelKernelsName());
+	printf("    RGBW Pixels:   %s\n", (arguments.rgbw_mode == RGBW_PASSTHROUGH) ? "passthrough" : "convert to RGB");
+	printf("    Max Pixels:    %i\n", arguments.max_pixels);
+	if (arguments.keepalive) {
+		printf("    Deduplicate:   unchanged frames resent every %i ms\n", arguments.keepalive);
+	}
+	if (arguments.correct_enabled) {
+		printf("    Correction:    gamma %.2f, brightness %.2f, white %.2f,%.2f,%.2f,%.2f%s%s\n",
+			arguments.correct.gamma, arguments.correct.brightness,
+			arguments.correct.white[0], arguments.correct.white[1],
+			arguments.correct.white[2], arguments.correct.white[3],
+			arguments.correct_path ? ", per-channel from " : "",
+			arguments.correct_path ? arguments.correct_path : "");
+	}
+	if (arguments.shm_name != NULL) {
+		printf("    Shared Memory: %s (%i slots)\n", arguments.shm_name, arguments.shm_slots);
+	}
+	if (arguments.unix_path != NULL) {
+		printf("    Unix Socket:   %s\n", arguments.unix_path);
+	}
+	if (arguments.pipe_path != NULL) {
+		printf("    Video Output:  %s (%s", arguments.pipe_path,
+			(arguments.pipe_format == PIPE_FORMAT_Y4M) ? "y4m" : "rgb24");
+		if (arguments.pipe_width) printf(" %ix%i", arguments.pipe_width, arguments.pipe_height);
+		printf(")\n");
+	}
+	if (arguments.metrics_port) {
+		printf("    Metrics Port:  %i\n", arguments.metrics_port);
+	}
+	if (arguments.trace_path != NULL) {
+		printf("    Trace File:    %s\n", arguments.trace_path);
+	}
+	if (arguments.perf) {
+		printf("    Perf Counters: ingest and publish stages\n");
+	}
+	if (arguments.rt_priority) {
+		printf("    Real-time:     SCHED_FIFO priority %i\n", arguments.rt_priority);
+	}
+	if (arguments.ingest_cpu >= 0) {
+		printf("    Ingest CPU:    %i\n", arguments.ingest_cpu);
+	}
+	if (arguments.send_cpu >= 0) {
+		printf("    Send CPU:      %i\n", arguments.send_cpu);
+	}
+	if (arguments.mlockall) {
+		printf("    Memory:        locked\n");
+	}
+	if (arguments.always_decode) {
+		printf("    Lazy Ingest:   off\n");
+	}
+	if (arguments.watchdog == WATCHDOG_OFF) {
+		printf("    Watchdog:      off\n");
+	}
+	else if (arguments.watchdog) {
+		printf("    Watchdog:      %i ms\n", arguments.watchdog);
+	}
+	if (arguments.raster_path != NULL) {
+		printf("    Image Output:  %s (%s %ix%i, %s)\n", arguments.raster_out,
+			(arguments.raster_format == PIPE_FORMAT_Y4M) ? "y4m" : "rgb24",
+			arguments.raster_width, arguments.raster_height,
+			(arguments.raster_mode == RASTER_SPLAT) ? "splat" : "nearest");
+	}
 
 	printf("Initializing...\n");
+	rgbwMode = arguments.rgbw_mode;
+	keepalive = arguments.keepalive;
+	watchdog = arguments.watchdog;
+	lazyIngest = !arguments.always_decode;
 
 // set up signal handler for clean termination
     sigIntHandler.sa_handler = pbxSignalHandler;
@@ -199,20 +970,82 @@ bool setup(int argc, char *argv[]) {
 	sigIntHandler.sa_flags = 0;
 	sigaction(SIGINT, &sigIntHandler, NULL);
 
+// the rest just raise flags, and shouldn't interrupt a serial read
+	sigIntHandler.sa_flags = SA_RESTART;
+	sigIntHandler.sa_handler = pbxDumpHandler;
+	sigaction(SIGUSR1, &sigIntHandler, NULL);
+
+// allocate frame buffers
+	if (!allocateBuffers(&arguments)) {
+		printf("   Error: Unable to allocate frame buffers\n");
+		exit(-1);
+	}
+	printf("    Frame buffers: %zu KB%s%s\n", arena->size / 1024,
+		(arena->flags & ARENA_HUGETLB) ? ", huge pages" : (arena->flags & ARENA_THP) ? ", transparent huge pages" : "",
+		(arena->flags & ARENA_LOCKED) ? ", locked" : "");
+	if (frame.capacity > UDP_MAX_PAYLOAD) {
+		printf("    Note: frames over %i bytes are too big for UDP clients\n", UDP_MAX_PAYLOAD);
+	}
+
+// build color correction tables
+	if (arguments.correct_enabled) {
+		corrector = createColorCorrector(&arguments.correct, arguments.correct_path);
+		if (corrector == NULL) {
+			printf("   Error: Unable to set up color correction\n");
+			exit(-1);
+		}
+		sigIntHandler.sa_handler = pbxReloadHandler;
+		sigaction(SIGHUP, &sigIntHandler, NULL);
+	}
+
+// load pixel map
+	if (arguments.map_path != NULL) {
+		remapper = createPixelRemap(arguments.map_path);
+		if (remapper == NULL) {
+			printf("   Error: Unable to load pixel map\n");
+			exit(-1);
+		}
+		printf("    Pixel map %s: %u pixels\n", arguments.map_path, remapper->count);
+	}
+
+// load raster map and plan the images
+	if (arguments.raster_path != NULL) {
+		raster = createPixelRaster(arguments.raster_path, arguments.raster_width,
+			arguments.raster_height, arguments.raster_mode);
+		if (raster == NULL) {
+			printf("   Error: Unable to load raster map\n");
+			exit(-1);
+		}
+		printf("    Raster map %s: %u pixels, %u plan entries", arguments.raster_path,
+			raster->count, raster->planCount);
+		if (raster->mode == RASTER_SPLAT) printf(", radius %.1f", raster->radius);
+		printf("\n");
+	}
+
 // open and configure serial device
 	printf("    Opening serial device %s\n",arguments.serial_port);
 
-	serialHandle = serialOpen (arguments.serial_port, RCV_BITRATE);
+	serialHandle = serialOpen (arguments.serial_port, arguments.baud);
 	if (serialHandle == -1) {
 		printf("   ERROR: Unable to open serial device %s\n",arguments.serial_port);
 		exit(1);
 	}
-	printf("    %s open at %lu bps\n",arguments.serial_port,RCV_BITRATE);
+	printf("    %s open at %i bps\n",arguments.serial_port,arguments.baud);
+
+// check what the driver actually gave us.  UARTs divide down a clock, so
+// an odd rate may come out a little off; more than 2% and bytes won't
+// survive the trip.
+	actualBaud = serialSpeed(serialHandle);
+	if ((actualBaud > 0) && (abs(actualBaud - arguments.baud) > arguments.baud / 50)) {
+		printf("   WARNING: %s reports %i bps, not %i\n",arguments.serial_port,actualBaud,arguments.baud);
+	}
+	uartCounted = (serialErrors(serialHandle,&uartBase) == 0);
+	if (!uartCounted) printf("    No UART error counts for this device\n");
 
 // set up UDP server
 	printf("    Initializing UDP transport\n");
 
-	udp = createUdpServer(arguments.bind_ip, arguments.listen_port,arguments.send_port);
+	udp = createUdpServer(arguments.bind_ip, arguments.listen_port,arguments.send_port,&queue);
 
 	if (udp == NULL) {
 		printf("   Error: Unable to create UDP socket\n");
@@ -220,6 +1053,83 @@ bool setup(int argc, char *argv[]) {
 	}
 	printf("    Network ready\n");
 
+// set up Prometheus metrics endpoint
+	if (arguments.metrics_port) {
+		metrics = createMetricsServer(arguments.bind_ip, arguments.metrics_port);
+		if (metrics == NULL) {
+			printf("   Error: Unable to create metrics endpoint\n");
+			exit(-1);
+		}
+	}
+
+// set up shared memory frame ring for local consumers
+	if (arguments.shm_name != NULL) {
+		printf("    Creating shared memory frame ring %s\n", arguments.shm_name);
+		shm = createShmRing(arguments.shm_name, arguments.shm_slots, frame.capacity);
+		if (shm == NULL) {
+			printf("   Error: Unable to create shared memory frame ring\n");
+			exit(-1);
+		}
+	}
+
+// set up unix domain socket server for local clients
+	if (arguments.unix_path != NULL) {
+		printf("    Initializing unix socket transport\n");
+		local = createUnixServer(arguments.unix_path, frame.capacity);
+		if (local == NULL) {
+			printf("   Error: Unable to create unix socket server\n");
+			exit(-1);
+		}
+	}
+
+// set up raw video output
+	if (arguments.pipe_path != NULL) {
+		printf("    Initializing video output\n");
+		video = createPipeOutput(arguments.pipe_path, arguments.pipe_format, arguments.pipe_width,
+			arguments.pipe_height, arguments.pipe_fps, frame.capacity);
+		if (video == NULL) {
+			printf("   Error: Unable to create video output\n");
+			exit(-1);
+		}
+	}
+	if (raster != NULL) {
+		printf("    Initializing image output\n");
+		rasterVideo = createPipeOutput(arguments.raster_out, arguments.raster_format, arguments.raster_width,
+			arguments.raster_height, arguments.pipe_fps, raster->imageSize);
+		if (rasterVideo == NULL) {
+			printf("   Error: Unable to create image output\n");
+			exit(-1);
+		}
+	}
+
+// start tracing before any of the traced threads
+	if (arguments.trace_path != NULL) {
+		if (createTrace(arguments.trace_path) < 0) {
+			printf("   Error: Unable to start tracing\n");
+			exit(-1);
+		}
+		traceThread("serial");
+	}
+
+// likewise the perf counters, which each thread opens for itself
+	perfEnabled = arguments.perf;
+	perfThread(PERF_INGEST);
+
+// start the transform thread last, once all the outputs exist
+	sendCpu = arguments.send_cpu;
+	pthread_create(&transformPt, NULL, &transformThread, NULL);
+
+// now that the other threads have started, and won't inherit them, put
+// the serial thread on its own CPU and real-time priority
+	pinThread("ingest",arguments.ingest_cpu);
+	setRealtime(arguments.rt_priority);
+
+// and keep every page we use in RAM.  Pages are locked as they're first
+// touched, so thread stacks don't get faulted in whole.
+	if (arguments.mlockall && (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) < 0)) {
+		printf("pbxTeleporter: unable to lock memory: %s\n",strerror(errno));
+	}
+
 	printf("Initialization successful.\n");
 	printf("pbxTeleporter running. <Ctrl-C> to terminate.\n");
 	serialFlush(serialHandle);
@@ -231,36 +1141,93 @@ bool setup(int argc, char *argv[]) {
 // via UDP
 int main(int argc, char *argv[]) {
 	PBFrameHeader hdr;
+	bool synced = false;
 
 // initialize configuration and serial and net comms.
+	metricsThread(METRIC_THREAD_SERIAL);
 	setup(argc,argv);
 
 	// loop forever
 	while (runFlag) {
-		// read characters 'till we get the magic sequence
-		if (readMagicWord()) {
+		// read characters 'till we get the magic sequence.  Every command
+		// is followed directly by the next, so anything else means we've
+		// lost our place.
+		if (!readMagicWord()) {
+			if (synced) metricAdd(M_RESYNCS,1);
+			synced = false;
+
+			// bytes are coming in, but none of them make sense
+			if (!streamStale && (watchdog != WATCHDOG_OFF) &&
+				(getTickCount() - lastProgress > (uint64_t) watchdogTimeout())) stalled = true;
+		}
+		else {
+			synced = true;
+			// decide at the start of each frame whether it's worth decoding
+			if (frame.started == 0) {
+				frame.started = latencyNow();
+				ingestIdle = !anyoneListening();
+			}
 			readBytes((uint8_t *) &hdr,sizeof(hdr));
+			if (stalled) hdr.command = 0;
 
 			switch (hdr.command) {
 			case SET_CHANNEL_WS2812:
-				doSetChannelWS2812();
+				doSetChannelWS2812(hdr.channel);
+				frame.lastRecord = latencyNow();
 				break;
 			case DRAW_ALL:
 				doDrawAll();
 				break;
 			case SET_CHANNEL_APA102_DATA:
-				doSetChannelAPA102();
+				doSetChannelAPA102(hdr.channel);
+				frame.lastRecord = latencyNow();
 				break;
 			case SET_CHANNEL_APA102_CLOCK:
-				doSetChannelAPA102Clock();
+				doSetChannelAPA102Clock(hdr.channel);
 				break;
 			default:
 				break;
 			}
 		}
+
+		if (stalled) recoverSerial();
 	}
 
 	printf("pbxTeleporter shutting down.\n");
+	frameQueueStop(&queue);
+	pthread_join(transformPt, NULL);
+	printBoardStats();
+	perfDump(stdout);
+	perfClose();
+	destroyTrace();
+	if (queue.dropped) {
+		printf("    %llu of %llu frames skipped by the transform thread\n",
+			(unsigned long long) queue.dropped, (unsigned long long) queue.frames);
+	}
+	if (metricRead(M_SERIAL_STALLS)) {
+		printf("    Serial stream reset %llu times by the watchdog\n", (unsigned long long) metricRead(M_SERIAL_STALLS));
+	}
+	pollSerialErrors();
+	if (uartCounted) {
+		printf("    UART errors: %llu overrun, %llu framing, %llu parity, %llu break, %llu buffer overrun\n",
+			(unsigned long long) metricRead(M_UART_OVERRUNS), (unsigned long long) metricRead(M_UART_FRAMING),
+			(unsigned long long) metricRead(M_UART_PARITY), (unsigned long long) metricRead(M_UART_BREAKS),
+			(unsigned long long) metricRead(M_UART_BUFFER_OVERRUNS));
+	}
+	if (keepalive) {
+		printf("    %llu of %llu frames unchanged, not sent\n",
+			(unsigned long long) metricRead(M_FRAMES_DEDUPED), (unsigned long long) (queue.frames - queue.dropped));
+	}
 	destroyUdpServer(udp);
+	destroyMetricsServer(metrics);
+	destroyShmRing(shm);
+	destroyUnixServer(local);
+	destroyPipeOutput(video);
+	destroyPipeOutput(rasterVideo);
 	serialClose(serialHandle);
+	destroyColorCorrector(corrector);
+	destroyPixelRemap(remapper);
+	destroyPixelRaster(raster);
+	frameQueueDestroy(&queue);
+	destroyFrameArena(arena);
 }
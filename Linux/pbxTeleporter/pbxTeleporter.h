@@ -3,8 +3,8 @@
  * Serial -> UDP Bridge for Pixelblaze
  * Linux/Raspberry Pi version
  *
- * Reads data from a Pixelblaze by emulating a single (8 channel, 2048 pixel) output expander
- * board and forwards it over the network via UDP datagram on request.  The wire protocol is
+ * Reads data from a Pixelblaze by emulating up to 8 (8 channel) output expander boards
+ * and forwards it over the network via UDP datagram on request.  The wire protocol is
  * described in Ben Hencke's Pixelblaze Output Expander board repository at:
  * https://github.com/simap/pixelblaze_output_expander
  *
@@ -15,11 +15,21 @@
 #ifndef __pbxteleporter_h__
 #define __pbxteleporter_h__
 
-#define MAX_PIXELS     4096
-#define RCV_BITRATE    2000000L           // bits/sec coming from pixelblaze
-#define BUFFER_SIZE    (256+(MAX_PIXELS * 3))
+#define DEFAULT_MAX_PIXELS 4096           // frame capacity if --max-pixels isn't given
+#define RCV_BITRATE    2000000            // bits/sec coming from pixelblaze, unless --baud says otherwise
+#define UDP_MAX_PAYLOAD 65507             // largest frame we can send in one datagram
 #define DEFAULT_LISTEN_PORT 8081          // default UDP ports
 #define DEFAULT_SEND_PORT   8082
+#define DEFAULT_KEEPALIVE_MS 1000         // resend an unchanged frame this often with --dedup
+#define WATCHDOG_MIN_MS 20                // serial watchdog timeout limits, when it follows the frame rate
+#define WATCHDOG_MAX_MS 1000              // (also the timeout until the first frames arrive)
+#define WATCHDOG_OFF    -1
+#define SERIAL_RETRY_MS 100               // wait between reads while the serial device is gone
+#define SERIAL_ERROR_POLL_MS 1000         // how often to read the UART's error counts
+#define UDP_ACTIVE_MS   1000              // a UDP client that asked this recently is still watching
+
+#define RGBW_CONVERT     0                // fold white into RGB
+#define RGBW_PASSTHROUGH 1                // keep 4 byte RGBW pixels
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 // structures imported from pixelblaze expander source
@@ -61,10 +71,20 @@ typedef struct {
     uint32_t frequency;
 }  __attribute__((packed)) PBAPA102ClockChannel;
 
+// per-board statistics.  Board n handles channels n*8 to n*8+7.
+typedef struct {
+    uint64_t frames;                      // DRAW_ALLs with data from this board
+    uint64_t records;                     // channel records addressed to this board
+    uint64_t pixels;                      // pixels stored
+    uint64_t skipped;                     // records we couldn't store
+    uint8_t  channels;                    // bitmask of channels seen
+} boardStats;
+
 // global variables
-extern int runFlag;
-extern int clientRequestFlag;
-extern uint16_t pixelsReady;
-extern uint8_t pixel_buffer[];
+extern volatile int runFlag;
+extern volatile int clientRequestFlag;
+extern int rgbwMode;
+extern volatile uint32_t pixelsReady;
+extern uint8_t *pixel_buffer;
 
 #endif /* __pbxteleporter_h__ */
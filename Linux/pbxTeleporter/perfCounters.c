@@ -0,0 +1,242 @@
+/* perfCounters.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * perf_event counter groups for the ingest and publish stages.  See
+ * perfCounters.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfCounters.h"
+#include "metrics.h"
+
+int perfEnabled = 0;
+perfStage perfStages[PERF_STAGES];
+
+static const char *stageName[PERF_STAGES] = {
+	[PERF_INGEST]  = "ingest",
+	[PERF_PUBLISH] = "publish",
+};
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+	const char *name;
+	const char *help;
+} eventInfo[PERF_EVENTS] = {
+	[PERF_CYCLES]           = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles", "CPU cycles"},
+	[PERF_INSTRUCTIONS]     = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions", "Instructions retired"},
+	[PERF_CACHE_MISSES]     = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache_misses", "Cache misses"},
+	[PERF_CONTEXT_SWITCHES] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context_switches", "Context switches"},
+};
+
+// count one event on the calling thread, in group (or as a new group if -1)
+static int openEvent(int event, int group, int kernel) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = eventInfo[event].type;
+	attr.config = eventInfo[event].config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.exclude_kernel = !kernel;
+	attr.exclude_hv = 1;
+
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+// read the whole group at once.  Returns 0, or -1 if the read failed.
+static int readGroup(perfStage *ps, uint64_t *values) {
+	uint64_t buf[1 + PERF_EVENTS];
+
+	if (read(ps->leader, buf, sizeof(buf)) < (ssize_t) sizeof(uint64_t) || buf[0] != (uint64_t) ps->events) {
+		return -1;
+	}
+	for (int e = 0; e < PERF_EVENTS; e++) {
+		values[e] = (ps->slot[e] < 0) ? 0 : buf[1 + ps->slot[e]];
+	}
+	return 0;
+}
+
+// open the calling thread's counters for a stage.  Kernel time is counted
+// if we're allowed to, since that's where read() and send() spend theirs.
+// Does nothing if --perf is off.
+void perfThread(int stage) {
+	perfStage *ps = &perfStages[stage];
+	int err = 0;
+
+	if (!perfEnabled) return;
+
+	for (ps->kernel = 1; ps->kernel >= 0; ps->kernel--) {
+		ps->leader = -1;
+		ps->events = 0;
+		for (int e = 0; e < PERF_EVENTS; e++) {
+			ps->fd[e] = openEvent(e, ps->leader, ps->kernel);
+			ps->slot[e] = -1;
+			if (ps->fd[e] < 0) {
+				if (ps->leader < 0) err = errno;
+				continue;
+			}
+			if (ps->leader < 0) ps->leader = ps->fd[e];
+			ps->slot[e] = ps->events++;
+		}
+		if (ps->events) break;
+	}
+
+	if (ps->events == 0) {
+		printf("pbxTeleporter: perf counters unavailable for %s: %s\n", stageName[stage], strerror(err));
+		return;
+	}
+
+	if (ps->events < PERF_EVENTS) {
+		printf("pbxTeleporter: perf counters unavailable for %s:", stageName[stage]);
+		for (int e = 0; e < PERF_EVENTS; e++) {
+			if (ps->fd[e] < 0) printf(" %s", eventInfo[e].name);
+		}
+		printf("\n");
+	}
+	if (readGroup(ps, ps->last) < 0) {
+		printf("pbxTeleporter: unable to read perf counters for %s\n", stageName[stage]);
+		for (int e = 0; e < PERF_EVENTS; e++) {
+			if (ps->fd[e] >= 0) close(ps->fd[e]);
+		}
+		ps->events = 0;
+	}
+}
+
+// take the counts since the last sample and add them to the stage's
+// totals.  Only the stage's own thread may sample it.
+void perfSample(int stage) {
+	perfStage *ps = &perfStages[stage];
+	uint64_t now[PERF_EVENTS];
+
+	if (ps->events == 0 || readGroup(ps, now) < 0) return;
+
+	for (int e = 0; e < PERF_EVENTS; e++) {
+		__atomic_store_n(&ps->total[e], ps->total[e] + (now[e] - ps->last[e]), __ATOMIC_RELAXED);
+		ps->last[e] = now[e];
+	}
+	__atomic_store_n(&ps->frames, ps->frames + 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t readTotal(const perfStage *ps, int event) {
+	return __atomic_load_n(&ps->total[event], __ATOMIC_RELAXED);
+}
+
+static double perFrame(uint64_t count, uint64_t frames) {
+	return frames ? (double) count / frames : 0.0;
+}
+
+static double perCycle(const perfStage *ps) {
+	uint64_t cycles = readTotal(ps, PERF_CYCLES);
+	return cycles ? (double) readTotal(ps, PERF_INSTRUCTIONS) / cycles : 0.0;
+}
+
+// human readable table, for SIGUSR1 and shutdown
+void perfDump(FILE *f) {
+	if (!perfEnabled) return;
+
+	fprintf(f, "pbxTeleporter: perf counters per frame\n");
+	fprintf(f, "    %-8s %10s %10s %10s %6s %10s %8s\n", "stage", "frames", "cycles", "instr", "IPC", "cache miss", "ctx sw");
+	for (int s = 0; s < PERF_STAGES; s++) {
+		const perfStage *ps = &perfStages[s];
+		uint64_t frames = __atomic_load_n(&ps->frames, __ATOMIC_RELAXED);
+		if (ps->events == 0) continue;
+
+		fprintf(f, "    %-8s %10llu", stageName[s], (unsigned long long) frames);
+		for (int e = 0; e < PERF_EVENTS; e++) {
+			if (e == PERF_CACHE_MISSES) {
+				if (ps->slot[PERF_CYCLES] >= 0 && ps->slot[PERF_INSTRUCTIONS] >= 0) {
+					fprintf(f, " %6.2f", perCycle(ps));
+				}
+				else {
+					fprintf(f, " %6s", "-");
+				}
+			}
+			if (ps->slot[e] < 0) {
+				fprintf(f, (e == PERF_CONTEXT_SWITCHES) ? " %8s" : " %10s", "-");
+			}
+			else {
+				fprintf(f, (e == PERF_CONTEXT_SWITCHES) ? " %8.1f" : " %10.0f", perFrame(readTotal(ps, e), frames));
+			}
+		}
+		fprintf(f, "%s\n", ps->kernel ? "" : "  (user only)");
+	}
+
+	// what the byte at a time read loop costs
+	if (perfStages[PERF_INGEST].events && perfStages[PERF_INGEST].slot[PERF_CYCLES] >= 0 && metricRead(M_SERIAL_BYTES)) {
+		fprintf(f, "    ingest: %.1f cycles per serial byte\n",
+			(double) readTotal(&perfStages[PERF_INGEST], PERF_CYCLES) / metricRead(M_SERIAL_BYTES));
+	}
+	fflush(f);
+}
+
+// Prometheus counters per stage and event, plus cycles per frame and IPC
+// gauges.  Returns the length of the text.
+size_t perfFormat(char *buf, size_t size) {
+	size_t len = 0;
+
+	if (!perfEnabled) return 0;
+
+#define APPEND(...) if (len < size) len += snprintf(buf + len, size - len, __VA_ARGS__)
+	APPEND("# HELP pbx_perf_frames_total Frames counted by each stage's perf counters.\n"
+		"# TYPE pbx_perf_frames_total counter\n");
+	for (int s = 0; s < PERF_STAGES; s++) {
+		if (perfStages[s].events == 0) continue;
+		APPEND("pbx_perf_frames_total{stage=\"%s\"} %llu\n", stageName[s],
+			(unsigned long long) __atomic_load_n(&perfStages[s].frames, __ATOMIC_RELAXED));
+	}
+
+	for (int e = 0; e < PERF_EVENTS; e++) {
+		APPEND("# HELP pbx_perf_%s_total %s in each stage.\n"
+			"# TYPE pbx_perf_%s_total counter\n", eventInfo[e].name, eventInfo[e].help, eventInfo[e].name);
+		for (int s = 0; s < PERF_STAGES; s++) {
+			if (perfStages[s].slot[e] < 0 || perfStages[s].events == 0) continue;
+			APPEND("pbx_perf_%s_total{stage=\"%s\"} %llu\n", eventInfo[e].name, stageName[s],
+				(unsigned long long) readTotal(&perfStages[s], e));
+		}
+	}
+
+	APPEND("# HELP pbx_perf_cycles_per_frame Average CPU cycles each stage spends on a frame.\n"
+		"# TYPE pbx_perf_cycles_per_frame gauge\n");
+	for (int s = 0; s < PERF_STAGES; s++) {
+		const perfStage *ps = &perfStages[s];
+		if (ps->events == 0 || ps->slot[PERF_CYCLES] < 0) continue;
+		APPEND("pbx_perf_cycles_per_frame{stage=\"%s\"} %.0f\n", stageName[s],
+			perFrame(readTotal(ps, PERF_CYCLES), __atomic_load_n(&ps->frames, __ATOMIC_RELAXED)));
+	}
+
+	APPEND("# HELP pbx_perf_ipc Instructions per cycle in each stage.\n"
+		"# TYPE pbx_perf_ipc gauge\n");
+	for (int s = 0; s < PERF_STAGES; s++) {
+		const perfStage *ps = &perfStages[s];
+		if (ps->events == 0 || ps->slot[PERF_CYCLES] < 0 || ps->slot[PERF_INSTRUCTIONS] < 0) continue;
+		APPEND("pbx_perf_ipc{stage=\"%s\"} %.3f\n", stageName[s], perCycle(ps));
+	}
+#undef APPEND
+
+	return (len < size) ? len : size - 1;
+}
+
+void perfClose(void) {
+	for (int s = 0; s < PERF_STAGES; s++) {
+		perfStage *ps = &perfStages[s];
+		if (ps->events == 0) continue;
+
+		for (int e = 0; e < PERF_EVENTS; e++) {
+			if (ps->fd[e] >= 0) close(ps->fd[e]);
+		}
+		ps->events = 0;
+	}
+}
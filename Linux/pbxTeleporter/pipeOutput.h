@@ -0,0 +1,59 @@
+/* pipeOutput.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Raw video output to stdout or a FIFO, for feeding frames to ffmpeg and
+ * friends.  Frames are written as raw rgb24, or as a Y4M (YUV 4:4:4) stream
+ * with pixels laid out row by row on a width x height grid.  For example:
+ *
+ *   pbxTeleporter /dev/ttyUSB0 --pipe=- --pipe-format=y4m --pipe-size=32x16 | ffplay -
+ *
+ * Output never blocks the serial reader.  If the pipe is full, the frame is
+ * dropped and counted.
+ *
+ * Both formats are RGB, so RGBW channels (--rgbw=passthrough) have their
+ * white folded into the color the same way --rgbw=rgb does.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __pipeoutput_h__
+#define __pipeoutput_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "frameStore.h"
+
+#define PIPE_FORMAT_RGB24   0
+#define PIPE_FORMAT_Y4M     1
+#define DEFAULT_PIPE_FPS    30
+
+typedef struct _pipeOutput {
+    char *path;                           // FIFO or file name, "-" for stdout
+    int fd;                               // -1 while waiting for a reader
+    int isPipe;                           // fd is a pipe, so we can vmsplice
+    int format;
+    int width, height;                    // output grid, 0 for "whatever arrives"
+    int fps;                              // frame rate advertised in Y4M header
+    size_t frameSize;                     // bytes per output frame, 0 = variable
+    uint8_t *ring;                        // page aligned frame slots handed to the kernel
+    size_t ringSize;
+    size_t slotSize;
+    int slotCount;
+    uint64_t frameSeq;
+    const uint8_t *pending;               // unsent tail of a partially written frame
+    size_t pendingLen;
+    uint64_t written;                     // frames written
+    uint64_t dropped;                     // frames dropped because reader was slow
+} pipeOutput;
+
+int pipeSetStdout(void);
+pipeOutput *createPipeOutput(const char *path, int format, int width, int height, int fps, size_t maxFrameSize);
+void pipeOutputWrite(pipeOutput *po, const uint8_t *frame, size_t len);
+void pipeOutputWriteFrame(pipeOutput *po, const frameStore *fs);
+void destroyPipeOutput(pipeOutput *po);
+
+#endif /* __pipeoutput_h__ */
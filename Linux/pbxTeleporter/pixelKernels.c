@@ -0,0 +1,527 @@
+/* pixelKernels.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Vectorized pixel conversion routines.  See pixelKernels.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdint.h>
+#include <string.h>
+
+#include "pixelKernels.h"
+
+// build with -DPIXEL_KERNELS_SCALAR for plain C only, which is how the
+// bench target compares the vector kernels against the fallbacks
+#if defined(PIXEL_KERNELS_SCALAR)
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_KERNELS_SSSE3
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PIXEL_KERNELS_NEON
+#endif
+
+#ifdef PIXEL_KERNELS_SSSE3
+// RGBW -> RGB masks for four 4-byte pixels.  rgbwColor picks out RGB as
+// four 3-byte pixels and rgbwWhite repeats each pixel's white value three
+// times to line up with them.  The last four bytes are zeroed (0x80).
+static const uint8_t rgbwColor[16] __attribute__((aligned(16))) = {
+	0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80
+};
+static const uint8_t rgbwWhite[16] __attribute__((aligned(16))) = {
+	3, 3, 3, 7, 7, 7, 11, 11, 11, 15, 15, 15, 0x80, 0x80, 0x80, 0x80
+};
+
+// APA102 compaction mask.  Drop each pixel's brightness byte and keep the
+// three colors that follow it, as four 3-byte pixels.
+static const uint8_t apaColor[16] __attribute__((aligned(16))) = {
+	1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, 0x80, 0x80, 0x80, 0x80
+};
+
+// brightness extraction mask, and masks that spread 16 per-pixel
+// brightness values across three vectors of 3-byte pixel data
+static const uint8_t apaBrightness[16] __attribute__((aligned(16))) = {
+	0, 4, 8, 12, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80
+};
+static const uint8_t spread3[3][16] __attribute__((aligned(16))) = {
+	{ 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5 },
+	{ 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,10,10 },
+	{10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15 }
+};
+#endif
+
+// 16 bit scale factor for brightness b is b * HDR_SCALE, about b/31 * 65536
+#define HDR_SCALE          2114
+#define APA102_FULL_SCALE  (31 * HDR_SCALE)
+
+static int useSSSE3 = 0;
+
+// byte at a time CRC-32 table
+static uint32_t crcTable[256];
+
+void pixelKernelsInit(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+		crcTable[i] = c;
+	}
+
+#ifdef PIXEL_KERNELS_SSSE3
+	__builtin_cpu_init();
+	useSSSE3 = __builtin_cpu_supports("ssse3");
+#endif
+}
+
+const char *pixelKernelsName(void) {
+#if defined(PIXEL_KERNELS_NEON)
+	return "neon";
+#else
+	return useSSSE3 ? "ssse3" : "scalar";
+#endif
+}
+
+/////////////////////////////////
+// RGBW -> RGB conversion
+/////////////////////////////////
+
+static void rgbwScalar(const uint8_t *src, uint8_t *dst, uint32_t count) {
+	for (; count; count--, src += 4, dst += 3) {
+		int w = src[3];
+		int r = src[0] + w, g = src[1] + w, b = src[2] + w;
+		dst[0] = (r > 255) ? 255 : r;
+		dst[1] = (g > 255) ? 255 : g;
+		dst[2] = (b > 255) ? 255 : b;
+	}
+}
+
+#ifdef PIXEL_KERNELS_SSSE3
+// four pixels per shuffle pair.  Each store writes 16 bytes but only
+// advances 12, so we stop while there is still room for the overhang.
+__attribute__((target("ssse3")))
+static uint32_t rgbwSSSE3(const uint8_t *src, uint8_t *dst, uint32_t count) {
+	__m128i color = _mm_load_si128((const __m128i *) rgbwColor);
+	__m128i white = _mm_load_si128((const __m128i *) rgbwWhite);
+	uint32_t done = 0;
+
+	for (; count - done >= 6; done += 4, src += 16, dst += 12) {
+		__m128i v = _mm_loadu_si128((const __m128i *) src);
+		_mm_storeu_si128((__m128i *) dst,
+			_mm_adds_epu8(_mm_shuffle_epi8(v, color), _mm_shuffle_epi8(v, white)));
+	}
+	return done;
+}
+#endif
+
+#ifdef PIXEL_KERNELS_NEON
+static uint32_t rgbwNEON(const uint8_t *src, uint8_t *dst, uint32_t count) {
+	uint32_t done = 0;
+
+	for (; count - done >= 16; done += 16, src += 64, dst += 48) {
+		uint8x16x4_t in = vld4q_u8(src);
+		uint8x16x3_t out;
+		out.val[0] = vqaddq_u8(in.val[0], in.val[3]);
+		out.val[1] = vqaddq_u8(in.val[1], in.val[3]);
+		out.val[2] = vqaddq_u8(in.val[2], in.val[3]);
+		vst3q_u8(dst, out);
+	}
+	return done;
+}
+#endif
+
+void rgbwToRgb(const uint8_t *src, uint8_t *dst, uint32_t count) {
+	uint32_t done = 0;
+
+#if defined(PIXEL_KERNELS_SSSE3)
+	if (useSSSE3) done = rgbwSSSE3(src, dst, count);
+#elif defined(PIXEL_KERNELS_NEON)
+	done = rgbwNEON(src, dst, count);
+#endif
+
+	rgbwScalar(src + done * 4, dst + done * 3, count - done);
+}
+
+/////////////////////////////////
+// APA102 -> RGB compaction
+/////////////////////////////////
+
+static void apa102Scalar(const uint8_t *src, uint8_t *dst, uint32_t count) {
+	for (; count; count--, src += 4, dst += 3) {
+		dst[0] = src[1];
+		dst[1] = src[2];
+		dst[2] = src[3];
+	}
+}
+
+#ifdef PIXEL_KERNELS_SSSE3
+// same overhang rule as rgbwSSSE3()
+__attribute__((target("ssse3")))
+static uint32_t apa102SSSE3(const uint8_t *src, uint8_t *dst, uint32_t count) {
+	__m128i m = _mm_load_si128((const __m128i *) apaColor);
+	uint32_t done = 0;
+
+	for (; count - done >= 6; done += 4, src += 16, dst += 12) {
+		_mm_storeu_si128((__m128i *) dst, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src), m));
+	}
+	return done;
+}
+#endif
+
+#ifdef PIXEL_KERNELS_NEON
+static uint32_t apa102NEON(const uint8_t *src, uint8_t *dst, uint32_t count) {
+	uint32_t done = 0;
+
+	for (; count - done >= 16; done += 16, src += 64, dst += 48) {
+		uint8x16x4_t in = vld4q_u8(src);
+		uint8x16x3_t out;
+		out.val[0] = in.val[1];
+		out.val[1] = in.val[2];
+		out.val[2] = in.val[3];
+		vst3q_u8(dst, out);
+	}
+	return done;
+}
+#endif
+
+void apa102ToRgb(const uint8_t *src, uint8_t *dst, uint32_t count) {
+	uint32_t done = 0;
+
+#if defined(PIXEL_KERNELS_SSSE3)
+	if (useSSSE3) done = apa102SSSE3(src, dst, count);
+#elif defined(PIXEL_KERNELS_NEON)
+	done = apa102NEON(src, dst, count);
+#endif
+
+	apa102Scalar(src + done * 4, dst + done * 3, count - done);
+}
+
+/////////////////////////////////
+// HDR expansion
+/////////////////////////////////
+
+static void apa102BrightnessScalar(const uint8_t *src, uint8_t *bri, uint32_t count) {
+	for (; count; count--, src += 4) {
+		*bri++ = *src & 0x1f;
+	}
+}
+
+#ifdef PIXEL_KERNELS_SSSE3
+__attribute__((target("ssse3")))
+static uint32_t apa102BrightnessSSSE3(const uint8_t *src, uint8_t *bri, uint32_t count) {
+	__m128i m = _mm_load_si128((const __m128i *) apaBrightness);
+	__m128i five = _mm_set1_epi8(0x1f);
+	uint32_t done = 0;
+
+	for (; count - done >= 16; done += 16, src += 64, bri += 16) {
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src), m);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 16)), m);
+		__m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 32)), m);
+		__m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 48)), m);
+		__m128i v = _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b), _mm_unpacklo_epi32(c, d));
+		_mm_storeu_si128((__m128i *) bri, _mm_and_si128(v, five));
+	}
+	return done;
+}
+#endif
+
+#ifdef PIXEL_KERNELS_NEON
+static uint32_t apa102BrightnessNEON(const uint8_t *src, uint8_t *bri, uint32_t count) {
+	uint32_t done = 0;
+
+	for (; count - done >= 16; done += 16, src += 64, bri += 16) {
+		uint8x16x4_t in = vld4q_u8(src);
+		vst1q_u8(bri, vandq_u8(in.val[0], vdupq_n_u8(0x1f)));
+	}
+	return done;
+}
+#endif
+
+void apa102Brightness(const uint8_t *src, uint8_t *bri, uint32_t count) {
+	uint32_t done = 0;
+
+#if defined(PIXEL_KERNELS_SSSE3)
+	if (useSSSE3) done = apa102BrightnessSSSE3(src, bri, count);
+#elif defined(PIXEL_KERNELS_NEON)
+	done = apa102BrightnessNEON(src, bri, count);
+#endif
+
+	apa102BrightnessScalar(src + done * 4, bri + done, count - done);
+}
+
+static void expandHdrScalar(const uint8_t *src, const uint8_t *bri, uint16_t *dst, uint32_t pixels, uint8_t elements) {
+	uint32_t scale = APA102_FULL_SCALE;
+
+	for (; pixels; pixels--) {
+		if (bri != NULL) scale = *bri++ * HDR_SCALE;
+		for (int i = 0; i < elements; i++) {
+			*dst++ = (uint16_t) ((*src++ * 257 * scale + 0x8000) >> 16);
+		}
+	}
+}
+
+#ifdef PIXEL_KERNELS_SSSE3
+// round(a * b / 65536) for eight 16 bit lanes
+__attribute__((target("ssse3")))
+static inline __m128i mulRound16(__m128i a, __m128i b) {
+	__m128i hi = _mm_mulhi_epu16(a, b);
+	__m128i lo = _mm_mullo_epi16(a, b);
+	return _mm_add_epi16(hi, _mm_srli_epi16(lo, 15));
+}
+
+// scale 16 bytes of pixel data by 16 bytes of per-byte brightness
+__attribute__((target("ssse3")))
+static inline void expand16(__m128i v, __m128i b, uint16_t *dst) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i scale = _mm_set1_epi16(HDR_SCALE);
+	__m128i blo = _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), scale);
+	__m128i bhi = _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), scale);
+
+	_mm_storeu_si128((__m128i *) dst, mulRound16(_mm_unpacklo_epi8(v, v), blo));
+	_mm_storeu_si128((__m128i *) (dst + 8), mulRound16(_mm_unpackhi_epi8(v, v), bhi));
+}
+
+// 16 pixels per pass.  Per-pixel brightness is spread across the
+// pixel bytes with pshufb, 3 byte pixels only.
+__attribute__((target("ssse3")))
+static uint32_t expandHdrSSSE3(const uint8_t *src, const uint8_t *bri, uint16_t *dst, uint32_t pixels, uint8_t elements) {
+	uint32_t done = 0;
+
+	if (bri == NULL) {
+		__m128i full = _mm_set1_epi8(31);
+		uint32_t bytes = pixels * elements, i;
+		for (i = 0; bytes - i >= 16; i += 16) {
+			expand16(_mm_loadu_si128((const __m128i *) (src + i)), full, dst + i);
+		}
+		return i / elements;
+	}
+
+	if (elements != 3) return 0;
+
+	__m128i s0 = _mm_load_si128((const __m128i *) spread3[0]);
+	__m128i s1 = _mm_load_si128((const __m128i *) spread3[1]);
+	__m128i s2 = _mm_load_si128((const __m128i *) spread3[2]);
+
+	for (; pixels - done >= 16; done += 16, src += 48, bri += 16, dst += 48) {
+		__m128i b = _mm_loadu_si128((const __m128i *) bri);
+		expand16(_mm_loadu_si128((const __m128i *) src), _mm_shuffle_epi8(b, s0), dst);
+		expand16(_mm_loadu_si128((const __m128i *) (src + 16)), _mm_shuffle_epi8(b, s1), dst + 16);
+		expand16(_mm_loadu_si128((const __m128i *) (src + 32)), _mm_shuffle_epi8(b, s2), dst + 32);
+	}
+	return done;
+}
+#endif
+
+#ifdef PIXEL_KERNELS_NEON
+// round(v * 257 * scale / 65536) for eight lanes
+static inline uint16x8_t expand8NEON(uint8x8_t v, uint16x8_t scale) {
+	uint16x8_t v16 = vmulq_n_u16(vmovl_u8(v), 257);
+	uint32x4_t lo = vmull_u16(vget_low_u16(v16), vget_low_u16(scale));
+	uint32x4_t hi = vmull_u16(vget_high_u16(v16), vget_high_u16(scale));
+	return vcombine_u16(vrshrn_n_u32(lo, 16), vrshrn_n_u32(hi, 16));
+}
+
+static uint32_t expandHdrNEON(const uint8_t *src, const uint8_t *bri, uint16_t *dst, uint32_t pixels, uint8_t elements) {
+	uint32_t done = 0;
+
+	if (bri == NULL) {
+		uint16x8_t full = vdupq_n_u16(APA102_FULL_SCALE);
+		uint32_t bytes = pixels * elements, i;
+		for (i = 0; bytes - i >= 8; i += 8) {
+			vst1q_u16(dst + i, expand8NEON(vld1_u8(src + i), full));
+		}
+		return i / elements;
+	}
+
+	if (elements != 3) return 0;
+
+	for (; pixels - done >= 8; done += 8, src += 24, bri += 8, dst += 24) {
+		uint8x8x3_t in = vld3_u8(src);
+		uint16x8_t scale = vmulq_n_u16(vmovl_u8(vld1_u8(bri)), HDR_SCALE);
+		uint16x8x3_t out;
+		out.val[0] = expand8NEON(in.val[0], scale);
+		out.val[1] = expand8NEON(in.val[1], scale);
+		out.val[2] = expand8NEON(in.val[2], scale);
+		vst3q_u16(dst, out);
+	}
+	return done;
+}
+#endif
+
+void expandHdr(const uint8_t *src, const uint8_t *bri, uint16_t *dst, uint32_t pixels, uint8_t elements) {
+	uint32_t done = 0;
+
+#if defined(PIXEL_KERNELS_SSSE3)
+	if (useSSSE3) done = expandHdrSSSE3(src, bri, dst, pixels, elements);
+#elif defined(PIXEL_KERNELS_NEON)
+	done = expandHdrNEON(src, bri, dst, pixels, elements);
+#endif
+
+	expandHdrScalar(src + done * elements, (bri != NULL) ? bri + done : NULL,
+		dst + done * elements, pixels - done, elements);
+}
+
+/////////////////////////////////
+// Lookup tables
+/////////////////////////////////
+
+static void applyLutScalar(const uint8_t *src, uint8_t *dst, uint32_t pixels, uint8_t elements, const uint8_t (*lut)[256]) {
+	if (elements == 3) {
+		for (; pixels; pixels--, src += 3, dst += 3) {
+			dst[0] = lut[0][src[0]];
+			dst[1] = lut[1][src[1]];
+			dst[2] = lut[2][src[2]];
+		}
+	}
+	else {
+		for (; pixels; pixels--) {
+			for (int i = 0; i < elements; i++) {
+				*dst++ = lut[i][*src++];
+			}
+		}
+	}
+}
+
+#if defined(PIXEL_KERNELS_NEON) && defined(__aarch64__)
+// full 256 entry lookup, 64 entries per tbl/tbx.  Indexes past the end
+// of a table leave the lane alone, so each step only fills its quarter.
+static inline uint8x16_t lookup256(const uint8_t *lut, uint8x16_t idx) {
+	uint8x16x4_t t;
+	uint8x16_t r;
+
+	for (int q = 0; q < 4; q++) {
+		t.val[0] = vld1q_u8(lut + q * 64);
+		t.val[1] = vld1q_u8(lut + q * 64 + 16);
+		t.val[2] = vld1q_u8(lut + q * 64 + 32);
+		t.val[3] = vld1q_u8(lut + q * 64 + 48);
+		if (q == 0) {
+			r = vqtbl4q_u8(t, idx);
+		}
+		else {
+			r = vqtbx4q_u8(r, t, vsubq_u8(idx, vdupq_n_u8(q * 64)));
+		}
+	}
+	return r;
+}
+
+// deinterleave 16 pixels so each color plane goes through its own table
+static uint32_t applyLutNEON(const uint8_t *src, uint8_t *dst, uint32_t pixels, uint8_t elements, const uint8_t (*lut)[256]) {
+	uint32_t done = 0;
+
+	if (elements == 3) {
+		for (; pixels - done >= 16; done += 16, src += 48, dst += 48) {
+			uint8x16x3_t v = vld3q_u8(src);
+			v.val[0] = lookup256(lut[0], v.val[0]);
+			v.val[1] = lookup256(lut[1], v.val[1]);
+			v.val[2] = lookup256(lut[2], v.val[2]);
+			vst3q_u8(dst, v);
+		}
+	}
+	else if (elements == 4) {
+		for (; pixels - done >= 16; done += 16, src += 64, dst += 64) {
+			uint8x16x4_t v = vld4q_u8(src);
+			v.val[0] = lookup256(lut[0], v.val[0]);
+			v.val[1] = lookup256(lut[1], v.val[1]);
+			v.val[2] = lookup256(lut[2], v.val[2]);
+			v.val[3] = lookup256(lut[3], v.val[3]);
+			vst4q_u8(dst, v);
+		}
+	}
+	return done;
+}
+#endif
+
+// SSSE3 has no byte gather, and a 256 entry pshufb lookup (16 shuffles
+// and selects per vector) measured slower than the scalar loop, so x86
+// uses the scalar version.
+void applyLut(const uint8_t *src, uint8_t *dst, uint32_t pixels, uint8_t elements, const uint8_t (*lut)[256]) {
+	uint32_t done = 0;
+
+#if defined(PIXEL_KERNELS_NEON) && defined(__aarch64__)
+	done = applyLutNEON(src, dst, pixels, elements, lut);
+#endif
+
+	applyLutScalar(src + done * elements, dst + done * elements, pixels - done, elements, lut);
+}
+
+/////////////////////////////////
+// Hashing and CRCs
+/////////////////////////////////
+
+// serial data arrives a few hundred KB/s at most, so a table per byte
+// is plenty
+uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t len) {
+	while (len--) {
+		crc = crcTable[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#define HASH_PRIME1 0x9e3779b185ebca87ULL
+#define HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define HASH_PRIME3 0x165667b19e3779f9ULL
+#define HASH_PRIME4 0x85ebca77c2b2ae63ULL
+#define HASH_PRIME5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t hashRound(uint64_t acc, uint64_t in) {
+	return rotl64(acc + in * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+static inline uint64_t hashMerge(uint64_t h, uint64_t lane) {
+	return (h ^ hashRound(0, lane)) * HASH_PRIME1 + HASH_PRIME4;
+}
+
+uint64_t hashBytes(const uint8_t *data, size_t len, uint64_t seed) {
+	const uint8_t *end = data + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		uint64_t v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+		uint64_t v2 = seed + HASH_PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - HASH_PRIME1;
+
+		for (; data + 32 <= end; data += 32) {
+			v1 = hashRound(v1, load64(data));
+			v2 = hashRound(v2, load64(data + 8));
+			v3 = hashRound(v3, load64(data + 16));
+			v4 = hashRound(v4, load64(data + 24));
+		}
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = hashMerge(h, v1);
+		h = hashMerge(h, v2);
+		h = hashMerge(h, v3);
+		h = hashMerge(h, v4);
+	}
+	else {
+		h = seed + HASH_PRIME5;
+	}
+	h += (uint64_t) len;
+
+	for (; data + 8 <= end; data += 8) {
+		h = rotl64(h ^ hashRound(0, load64(data)), 27) * HASH_PRIME1 + HASH_PRIME4;
+	}
+	for (; data < end; data++) {
+		h = rotl64(h ^ (*data * HASH_PRIME5), 11) * HASH_PRIME1;
+	}
+
+// final mix so every input bit affects every output bit
+	h ^= h >> 33;
+	h *= HASH_PRIME2;
+	h ^= h >> 29;
+	h *= HASH_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
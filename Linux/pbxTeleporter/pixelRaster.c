@@ -0,0 +1,308 @@
+/* pixelRaster.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Pixel map to image rasterizer.  See pixelRaster.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "pixelRaster.h"
+
+#define MAX_SPLAT_RADIUS 64.0f
+
+// add one LED position to the map
+static void addPoint(pixelRaster *pr, uint32_t *size, float x, float y) {
+	if (pr->count == *size) {
+		*size *= 2;
+		pr->x = (float *) realloc(pr->x, *size * sizeof(float));
+		pr->y = (float *) realloc(pr->y, *size * sizeof(float));
+	}
+	pr->x[pr->count] = x;
+	pr->y[pr->count] = y;
+	pr->count++;
+}
+
+// read the map file.  A position is the first two numbers in an innermost
+// [...] group if the file has brackets, otherwise the first two numbers on
+// a line.  Returns 0, or -1 if the file is no good.
+static int loadMap(pixelRaster *pr) {
+	FILE *f;
+	int c, brackets = 0, n = 0, bad = 0;
+	uint32_t size = 1024;
+	float v[2];
+
+	f = fopen(pr->path, "r");
+	if (f == NULL) {
+		printf("pbxTeleporter: unable to open raster map %s\n", pr->path);
+		return -1;
+	}
+
+	pr->x = (float *) malloc(size * sizeof(float));
+	pr->y = (float *) malloc(size * sizeof(float));
+	while (!bad && (c = fgetc(f)) != EOF) {
+		if (c == '#') {
+			while ((c = fgetc(f)) != EOF && c != '\n');
+			if (c == EOF) break;
+		}
+		if (c == '[') {
+			brackets = 1;
+			n = 0;
+			continue;
+		}
+		if ((c == ']') || (!brackets && c == '\n')) {
+			if (n >= 2) addPoint(pr, &size, v[0], v[1]);
+			else if (n == 1) bad = 1;
+			n = 0;
+			continue;
+		}
+		if (isspace(c) || c == ',') continue;
+
+		if (isdigit(c) || c == '-' || c == '+' || c == '.') {
+			float f1;
+			ungetc(c, f);
+			if (fscanf(f, "%f", &f1) != 1) bad = 1;
+			if (n < 2) v[n] = f1;
+			n++;
+			continue;
+		}
+		bad = 1;
+	}
+	if (!bad && n >= 2) addPoint(pr, &size, v[0], v[1]);
+	fclose(f);
+
+	if (bad || pr->count == 0) {
+		printf("pbxTeleporter: %s is not a raster map\n", pr->path);
+		return -1;
+	}
+	return 0;
+}
+
+static int compareFloat(const void *a, const void *b) {
+	float fa = *(const float *) a, fb = *(const float *) b;
+	return (fa > fb) - (fa < fb);
+}
+
+// LEDs are nearly always wired so that each one is next to the one
+// before it, so the median distance between consecutive LEDs is a good
+// guess at their spacing without a nearest neighbor search.
+static float ledSpacing(const float *x, const float *y, uint32_t count) {
+	float *d, spacing;
+	uint32_t n = 0;
+
+	if (count < 2) return 0.0f;
+	d = (float *) malloc((count - 1) * sizeof(float));
+	for (uint32_t i = 1; i < count; i++) {
+		float dist = hypotf(x[i] - x[i - 1], y[i] - y[i - 1]);
+		if (dist > 0.0f) d[n++] = dist;
+	}
+	qsort(d, n, sizeof(float), compareFloat);
+	spacing = n ? d[n / 2] : 0.0f;
+	free(d);
+	return spacing;
+}
+
+// work out where each LED lands in the image, and which image pixels it
+// lights, then sort the lot by image pixel so a frame is drawn in one
+// pass over the image.
+static void buildPlan(pixelRaster *pr) {
+	float minX = pr->x[0], maxX = pr->x[0], minY = pr->y[0], maxY = pr->y[0];
+	float scale, offX, offY, *px, *py;
+	uint32_t size, n = 0, *start;
+	rasterEntry *sorted;
+
+	for (uint32_t i = 1; i < pr->count; i++) {
+		if (pr->x[i] < minX) minX = pr->x[i];
+		if (pr->x[i] > maxX) maxX = pr->x[i];
+		if (pr->y[i] < minY) minY = pr->y[i];
+		if (pr->y[i] > maxY) maxY = pr->y[i];
+	}
+
+// fit the map to the image without stretching it
+	scale = 0.0f;
+	if (maxX > minX) scale = (pr->width - 1) / (maxX - minX);
+	if (maxY > minY) {
+		float s = (pr->height - 1) / (maxY - minY);
+		if (scale == 0.0f || s < scale) scale = s;
+	}
+	offX = ((pr->width - 1) - (maxX - minX) * scale) / 2.0f;
+	offY = ((pr->height - 1) - (maxY - minY) * scale) / 2.0f;
+
+	px = (float *) malloc(pr->count * sizeof(float));
+	py = (float *) malloc(pr->count * sizeof(float));
+	for (uint32_t i = 0; i < pr->count; i++) {
+		px[i] = (pr->x[i] - minX) * scale + offX;
+		py[i] = (pr->y[i] - minY) * scale + offY;
+	}
+
+	if (pr->mode == RASTER_SPLAT) {
+		pr->radius = ledSpacing(px, py, pr->count);
+		if (pr->radius < 1.0f) pr->radius = 1.0f;
+		if (pr->radius > MAX_SPLAT_RADIUS) pr->radius = MAX_SPLAT_RADIUS;
+	}
+	else {
+		pr->radius = 0.0f;
+	}
+
+	size = pr->count;
+	pr->plan = (rasterEntry *) malloc(size * sizeof(rasterEntry));
+	for (uint32_t i = 0; i < pr->count; i++) {
+		int x0, x1, y0, y1;
+
+		if (pr->mode == RASTER_NEAREST) {
+			pr->plan[n].dst = (uint32_t) lrintf(py[i]) * pr->width + (uint32_t) lrintf(px[i]);
+			pr->plan[n].led = i;
+			pr->plan[n].weight = 256;
+			n++;
+			continue;
+		}
+
+// splats are cones, full brightness at the LED fading to nothing at
+// the radius, so neighbors a radius apart blend smoothly
+		x0 = (int) ceilf(px[i] - pr->radius);
+		x1 = (int) floorf(px[i] + pr->radius);
+		y0 = (int) ceilf(py[i] - pr->radius);
+		y1 = (int) floorf(py[i] + pr->radius);
+		if (x0 < 0) x0 = 0;
+		if (y0 < 0) y0 = 0;
+		if (x1 >= pr->width) x1 = pr->width - 1;
+		if (y1 >= pr->height) y1 = pr->height - 1;
+
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				float d = hypotf(x - px[i], y - py[i]);
+				uint32_t w = (uint32_t) lrintf(256.0f * (1.0f - d / pr->radius));
+				if (d >= pr->radius || w == 0) continue;
+				if (n == size) {
+					size *= 2;
+					pr->plan = (rasterEntry *) realloc(pr->plan, size * sizeof(rasterEntry));
+				}
+				pr->plan[n].dst = (uint32_t) y * pr->width + x;
+				pr->plan[n].led = i;
+				pr->plan[n].weight = w;
+				n++;
+			}
+		}
+	}
+	free(px);
+	free(py);
+
+// counting sort by image pixel, which keeps LEDs in map order within a pixel
+	size = (uint32_t) pr->width * pr->height;
+	start = (uint32_t *) calloc(size + 1, sizeof(uint32_t));
+	sorted = (rasterEntry *) malloc((n ? n : 1) * sizeof(rasterEntry));
+	for (uint32_t i = 0; i < n; i++) start[pr->plan[i].dst + 1]++;
+	for (uint32_t p = 1; p <= size; p++) start[p] += start[p - 1];
+	for (uint32_t i = 0; i < n; i++) sorted[start[pr->plan[i].dst]++] = pr->plan[i];
+	free(pr->plan);
+	free(start);
+
+// where dots overlap, scale their weights to add up to one LED's worth
+// so that drawing a pixel is a multiply-add per LED and a shift
+	for (uint32_t i = 0, j; i < n; i = j) {
+		uint32_t sum = 0;
+		for (j = i; j < n && sorted[j].dst == sorted[i].dst; j++) sum += sorted[j].weight;
+		if (sum <= 256) continue;
+		for (uint32_t k = i; k < j; k++) sorted[k].weight = sorted[k].weight * 256 / sum;
+	}
+
+	pr->plan = sorted;
+	pr->planCount = n;
+}
+
+pixelRaster *createPixelRaster(const char *path, int width, int height, int mode) {
+	pixelRaster *pr;
+
+	pr = (pixelRaster *) calloc(1, sizeof(pixelRaster));
+	pr->path = strdup(path);
+	pr->width = width;
+	pr->height = height;
+	pr->mode = mode;
+
+	if (loadMap(pr) < 0) {
+		destroyPixelRaster(pr);
+		return NULL;
+	}
+	buildPlan(pr);
+
+	pr->offset = (uint32_t *) malloc(pr->count * sizeof(uint32_t));
+	pr->imageSize = (size_t) width * height * 3;
+	pr->image = (uint8_t *) calloc(1, pr->imageSize);
+
+	return pr;
+}
+
+// find each LED's pixel data in a frame with fs's layout.  4 byte pixels
+// are drawn from their RGB part.
+static void buildOffsets(pixelRaster *pr, const frameStore *fs) {
+	pr->planned = 1;
+	pr->layout = fs->layout;
+
+	for (uint32_t i = 0; i < pr->count; i++) pr->offset[i] = RASTER_NO_PIXEL;
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		const channelEntry *e = &fs->dir[i];
+		uint32_t first = fs->pixelOffset[i];
+		if (e->length == 0 || first >= pr->count) continue;
+
+		for (uint32_t p = 0; p < e->pixels && first + p < pr->count; p++) {
+			pr->offset[first + p] = e->offset + p * e->elements;
+		}
+	}
+}
+
+// draw the frame.  Returns the image, which stays valid until the next call.
+const uint8_t *pixelRasterFrame(pixelRaster *pr, const frameStore *fs) {
+	const rasterEntry *e = pr->plan, *end = pr->plan + pr->planCount;
+	const uint8_t *in = fs->data;
+	uint8_t *img = pr->image;
+
+	if (!pr->planned || (pr->layout != fs->layout)) buildOffsets(pr, fs);
+	memset(img, 0, pr->imageSize);
+
+	if (pr->mode == RASTER_NEAREST) {
+		for (; e < end; e++) {
+			uint32_t off = pr->offset[e->led];
+			if (off == RASTER_NO_PIXEL) continue;
+			memcpy(img + e->dst * 3, in + off, 3);
+		}
+		return img;
+	}
+
+// splat -- blend every LED that touches an image pixel.  Weights are in
+// 256ths, so pixels with less than one LED's worth fade toward black.
+	while (e < end) {
+		uint32_t dst = e->dst, r = 128, g = 128, b = 128;
+
+		for (; e < end && e->dst == dst; e++) {
+			uint32_t off = pr->offset[e->led];
+			if (off == RASTER_NO_PIXEL) continue;
+			r += in[off] * e->weight;
+			g += in[off + 1] * e->weight;
+			b += in[off + 2] * e->weight;
+		}
+		img[dst * 3] = r >> 8;
+		img[dst * 3 + 1] = g >> 8;
+		img[dst * 3 + 2] = b >> 8;
+	}
+	return img;
+}
+
+void destroyPixelRaster(pixelRaster *pr) {
+	if (pr == NULL) return;
+
+	free(pr->x);
+	free(pr->y);
+	free(pr->plan);
+	free(pr->offset);
+	free(pr->image);
+	free(pr->path);
+	free(pr);
+}
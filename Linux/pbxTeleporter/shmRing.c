@@ -0,0 +1,158 @@
+/* shmRing.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Publishes completed frames into a POSIX shared memory ring so that
+ * consumers on the same machine can read them without going through
+ * the network stack.  See shmRing.h for the memory layout.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shmRing.h"
+
+// round up to a whole number of pages
+static size_t pageRound(size_t n) {
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	return (n + page - 1) & ~(page - 1);
+}
+
+// create and map the shared memory object.  Any stale object left
+// behind by a previous run is replaced.  If name is NULL, the ring is
+// backed by an anonymous memfd instead, which can be handed to other
+// processes over a unix domain socket.
+shmRing *createShmRing(const char *name, int slots, size_t maxFrameSize) {
+	shmRing *ring;
+	shmRingHeader *hdr;
+	size_t slotSize, dataOffset, slotDataOffset;
+
+	if (slots < 2 || slots > SHM_MAX_SLOTS) {
+		printf("pbxTeleporter: shm ring needs 2 to %d slots\n", SHM_MAX_SLOTS);
+		return NULL;
+	}
+
+	ring = (shmRing *) calloc(1, sizeof(shmRing));
+	ring->name = (name != NULL) ? strdup(name) : NULL;
+
+	dataOffset = pageRound(sizeof(shmRingHeader));
+	slotDataOffset = SHM_SLOT_HDR_SIZE + MAX_CHANNELS * sizeof(channelEntry);
+	slotSize = pageRound(slotDataOffset + maxFrameSize);
+	ring->mapSize = dataOffset + slotSize * slots;
+
+	if (name != NULL) {
+		shm_unlink(name);
+		ring->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, SHM_RING_MODE);
+		// shm_open() applies the umask, which usually takes group write away
+		if (ring->fd >= 0) fchmod(ring->fd, SHM_RING_MODE);
+	}
+	else {
+		ring->fd = memfd_create("pbxTeleporter", MFD_CLOEXEC);
+	}
+	if (ring->fd < 0) {
+		printf("pbxTeleporter: unable to create shm ring: %s\n", strerror(errno));
+		free(ring->name);
+		free(ring);
+		return NULL;
+	}
+
+	if (ftruncate(ring->fd, ring->mapSize) < 0) {
+		printf("pbxTeleporter: unable to size shm ring: %s\n", strerror(errno));
+		destroyShmRing(ring);
+		return NULL;
+	}
+
+	ring->base = mmap(NULL, ring->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->base == MAP_FAILED) {
+		printf("pbxTeleporter: unable to map shm ring: %s\n", strerror(errno));
+		ring->base = NULL;
+		destroyShmRing(ring);
+		return NULL;
+	}
+
+// new object is zero filled, so we only need to fill in the
+// geometry.  Magic goes in last so readers never see a half
+// initialized header.
+	hdr = ring->hdr = (shmRingHeader *) ring->base;
+	hdr->version = SHM_RING_VERSION;
+	hdr->slotCount = slots;
+	hdr->slotSize = slotSize;
+	hdr->dataOffset = dataOffset;
+	hdr->maxFrameSize = slotSize - slotDataOffset;
+	hdr->channelCount = MAX_CHANNELS;
+	hdr->slotDataOffset = slotDataOffset;
+	__atomic_store_n(&hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+	return ring;
+}
+
+// copy a completed frame into the next slot and wake any waiting readers.
+// Returns the sequence number of the new frame.
+uint64_t shmRingPublish(shmRing *ring, const frameStore *frame) {
+	shmRingHeader *hdr = ring->hdr;
+	shmSlotHeader *slot;
+	struct timespec ts;
+	uint64_t frameSeq;
+	uint32_t seq;
+	size_t len;
+
+	len = (frame->length > hdr->maxFrameSize) ? hdr->maxFrameSize : frame->length;
+
+	frameSeq = hdr->frameSeq + 1;
+	slot = shmSlot(hdr, frameSeq % hdr->slotCount);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+// seqlock write side: odd while we're in here.
+	seq = slot->seq;
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(shmSlotDirectory(slot), frame->dir, sizeof(frame->dir));
+	memcpy(shmSlotData(hdr, slot), frame->data, len);
+	slot->length = len;
+	slot->frameSeq = frameSeq;
+	slot->timestamp = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->frameSeq, frameSeq, __ATOMIC_RELEASE);
+
+// bump the futex word, and only make the syscall if somebody is asleep.
+// This store and the load of waiters have to be seen in order by readers,
+// which do the opposite (count themselves, then check the futex word), so
+// both sides are seq_cst.  Release/acquire would let the load pass the
+// store on ARM, and a reader that had just checked could sleep through
+// the frame.
+	__atomic_add_fetch(&hdr->futex, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hdr->waiters, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &hdr->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+
+	return frameSeq;
+}
+
+void destroyShmRing(shmRing *ring) {
+	if (ring == NULL) return;
+
+	if (ring->base != NULL) munmap(ring->base, ring->mapSize);
+	if (ring->fd >= 0) close(ring->fd);
+	if (ring->name != NULL) {
+		shm_unlink(ring->name);
+		free(ring->name);
+	}
+	free(ring);
+}
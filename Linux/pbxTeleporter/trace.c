@@ -0,0 +1,166 @@
+/* trace.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Per-thread span rings and the Chrome trace JSON writer.  See trace.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "latency.h"
+
+#define TRACE_MAX_THREADS 16
+
+int traceEnabled = 0;
+
+static __thread traceRing *threadRing = NULL;
+static traceRing *rings[TRACE_MAX_THREADS];
+static int ringCount = 0;
+static int announced = 0;                 // rings whose thread name has been written
+static pthread_mutex_t ringLock = PTHREAD_MUTEX_INITIALIZER;
+
+static FILE *traceFile = NULL;
+static uint64_t origin;                   // latencyNow() when tracing started
+static uint64_t written = 0;
+static volatile int stopping = 0;
+static pthread_t flushPt;
+
+uint64_t traceNow(void) {
+	return latencyNow();
+}
+
+// record a span from start to now on the calling thread's ring
+void traceSpan(const char *name, uint64_t start, int64_t arg) {
+	traceRing *r = threadRing;
+	traceEvent *e;
+	uint32_t head;
+
+	if (r == NULL) return;
+
+	head = r->head;
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TRACE_RING_EVENTS) {
+		r->dropped++;
+		return;
+	}
+
+	e = &r->events[head & (TRACE_RING_EVENTS - 1)];
+	e->name = name;
+	e->start = start;
+	e->end = latencyNow();
+	e->arg = arg;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// give the calling thread a ring of its own.  Does nothing if tracing is off.
+void traceThread(const char *name) {
+	traceRing *r;
+
+	if (!traceEnabled) return;
+
+	pthread_mutex_lock(&ringLock);
+	if (ringCount < TRACE_MAX_THREADS) {
+		r = (traceRing *) calloc(1, sizeof(traceRing));
+		r->tid = ringCount + 1;
+		r->name = name;
+		rings[ringCount] = r;
+		__atomic_store_n(&ringCount, ringCount + 1, __ATOMIC_RELEASE);
+		threadRing = r;
+	}
+	pthread_mutex_unlock(&ringLock);
+}
+
+static void writeEvent(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void writeEvent(const char *fmt, ...) {
+	va_list args;
+
+	fputs(written++ ? ",\n" : "\n", traceFile);
+	va_start(args, fmt);
+	vfprintf(traceFile, fmt, args);
+	va_end(args);
+}
+
+// write out everything the threads have recorded since the last flush
+static void flushRings(void) {
+	int n = __atomic_load_n(&ringCount, __ATOMIC_ACQUIRE);
+
+	for (; announced < n; announced++) {
+		writeEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			rings[announced]->tid, rings[announced]->name);
+	}
+
+	for (int i = 0; i < n; i++) {
+		traceRing *r = rings[i];
+		uint32_t tail = r->tail, head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+		for (; tail != head; tail++) {
+			traceEvent *e = &r->events[tail & (TRACE_RING_EVENTS - 1)];
+
+			if (e->arg < 0) {
+				writeEvent("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					e->name, r->tid, (e->start - origin) / 1000.0, (e->end - e->start) / 1000.0);
+			}
+			else {
+				writeEvent("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"n\":%lld}}",
+					e->name, r->tid, (e->start - origin) / 1000.0, (e->end - e->start) / 1000.0,
+					(long long) e->arg);
+			}
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+	fflush(traceFile);
+}
+
+static void *flushThread(void *arg) {
+	while (!stopping) {
+		usleep(TRACE_FLUSH_MS * 1000);
+		flushRings();
+	}
+	pthread_exit(NULL);
+}
+
+// start tracing to path.  Returns 0, or -1 if the file can't be written.
+int createTrace(const char *path) {
+	traceFile = fopen(path, "w");
+	if (traceFile == NULL) {
+		printf("pbxTeleporter: unable to open trace file %s\n", path);
+		return -1;
+	}
+
+	fputs("[", traceFile);
+	origin = latencyNow();
+	traceEnabled = 1;
+	pthread_create(&flushPt, NULL, &flushThread, NULL);
+	return 0;
+}
+
+// stop the flush thread, write whatever is left and close the file.  Call
+// after the traced threads have stopped.
+void destroyTrace(void) {
+	uint64_t dropped = 0;
+
+	if (traceFile == NULL) return;
+
+	traceEnabled = 0;
+	stopping = 1;
+	pthread_join(flushPt, NULL);
+	flushRings();
+	fputs("\n]\n", traceFile);
+	fclose(traceFile);
+
+	for (int i = 0; i < ringCount; i++) {
+		dropped += rings[i]->dropped;
+		free(rings[i]);
+	}
+	printf("    Trace: %llu spans written, %llu dropped\n",
+		(unsigned long long) (written - ringCount), (unsigned long long) dropped);
+}
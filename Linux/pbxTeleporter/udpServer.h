@@ -25,6 +25,47 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 
+#include "frameQueue.h"
+
+#define MAX_PENDING_REQUESTS 16
+
+// Client request datagram.  Any datagram that doesn't start with
+// PBX_REQUEST_MAGIC is treated as a request for the next frame in
+// the default 8 bit RGB format, as it always has been.
+#define PBX_REQUEST_MAGIC   "PTRQ"
+#define PBX_REQUEST_VERSION 1
+
+enum RequestFormat {
+  FORMAT_RGB8 = 0,      // 8 bits per element, as received
+  FORMAT_RGB16,         // 16 bits per element, little endian, scaled by APA102 brightness.
+                        // Made from the same 8 bit values as an RGB8 reply, so after any
+                        // --gamma or correction LUT unless PBX_REQUEST_RAW is set
+  FORMAT_COUNT
+};
+
+typedef struct {
+    char magic[4];                        // PBX_REQUEST_MAGIC
+    uint8_t version;                      // PBX_REQUEST_VERSION
+    uint8_t format;                       // RequestFormat
+    uint8_t flags;                        // PBX_REQUEST_*
+    uint8_t reserved;
+}  __attribute__((packed)) pbxRequest;
+
+// request flags
+#define PBX_REQUEST_RAW 0x01              // frame as received, no correction or remapping
+#define PBX_REQUEST_NOW 0x02              // answer from the latest frame published, without
+                                          // waiting for the next one
+#define PBX_REQUEST_RGB 0x04              // fold RGBW channels to 3 byte RGB.  With
+                                          // --rgbw=passthrough each client picks RGBW or RGB
+
+// a client waiting for a frame
+typedef struct {
+  struct sockaddr_in addr;
+  uint8_t format;
+  uint8_t flags;
+  uint64_t received;                      // latencyNow() when the request came in
+} pendingRequest;
+
 typedef struct _udpServer {
   int listen_port;
   int send_port;
@@ -32,13 +73,23 @@ typedef struct _udpServer {
   struct sockaddr_in server; 
   struct sockaddr_in client;   
   int clientlen;  
+  pendingRequest pending[MAX_PENDING_REQUESTS];
+  int pendingCount;
+  pendingRequest immediate[MAX_PENDING_REQUESTS];  // PBX_REQUEST_NOW requests
+  int immediateCount;
+  frameQueue *queue;                      // woken to answer immediate requests
+  uint64_t lastRequest;                   // latencyNow() at the last request, 0 if none yet
+  pthread_mutex_t lock;
   pthread_t pt;
 } udpServer;
 
 void _debugPrintAddress(struct sockaddr_in *addr);
-udpServer *createUdpServer(char *bind_addr, int listen_port, int send_port);
+udpServer *createUdpServer(char *bind_addr, int listen_port, int send_port, frameQueue *queue);
 int udpServerListen(udpServer *udp,uint8_t *rcvbuf,size_t bufsize);
-int udpServerSend(udpServer *udp, uint8_t *sendbuf,size_t bufsize);
+int udpServerSend(udpServer *udp, struct sockaddr_in *client, uint8_t *sendbuf,size_t bufsize);
+int udpServerTakeRequests(udpServer *udp, pendingRequest *requests);
+int udpServerTakeImmediate(udpServer *udp, pendingRequest *requests);
+void udpServerDefer(udpServer *udp, const pendingRequest *request);
 void destroyUdpServer(udpServer *udp);
 void *udpThread(void *arg);
 
@@ -0,0 +1,80 @@
+/* unixServer.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Unix domain (AF_UNIX, SOCK_SEQPACKET) frame server for clients running on
+ * the same machine as the bridge.  Connected clients receive every completed
+ * frame as a single message, in the same format as the UDP datagram.
+ * Clients that need to tell channels apart should use memfd mode, where
+ * each frame carries its channel directory.  Each client's socket buffer
+ * is sized to hold the largest frame, but the kernel may cap it (see
+ * net.core.wmem_max).  Frames too big for the buffer it allows are
+ * dropped for that client, so clients with big frames should use memfd
+ * mode.
+ *
+ * A client that would rather not have pixel data copied through the socket
+ * can send a one byte UNIX_REQ_MEMFD message after connecting.  The server
+ * answers with a unixRingMsg carrying a memfd frame ring (see shmRing.h) as
+ * SCM_RIGHTS ancillary data, and from then on sends only a small unixNotifyMsg
+ * per frame.  Map the fd with pbxShmOpenFd() and read frames in place.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __UNIXSERVER_H
+#define __UNIXSERVER_H
+#include <stdint.h>
+#include <pthread.h>
+#include "shmRing.h"
+
+#define DEFAULT_UNIX_PATH   "/tmp/pbxTeleporter.sock"
+#define MAX_UNIX_CLIENTS    16
+#define UNIX_SNDBUF_SLACK   65536         // socket buffer room beyond one frame
+
+// client -> server requests
+#define UNIX_REQ_MEMFD      'M'
+
+// server -> client messages in memfd mode
+#define UNIX_MSG_RING       1
+#define UNIX_MSG_NOTIFY     2
+
+typedef struct {
+    uint32_t magic;                       // SHM_RING_MAGIC
+    uint32_t type;                        // UNIX_MSG_RING
+    uint32_t slotCount;
+    uint32_t maxFrameSize;
+}  __attribute__((packed)) unixRingMsg;
+
+typedef struct {
+    uint32_t magic;                       // SHM_RING_MAGIC
+    uint32_t type;                        // UNIX_MSG_NOTIFY
+    uint64_t frameSeq;                    // frame to read from the ring
+    uint32_t length;                      // bytes of pixel data
+}  __attribute__((packed)) unixNotifyMsg;
+
+typedef struct {
+    int fd;
+    int memfdMode;                        // non-zero if client reads from the memfd ring
+    uint32_t dropped;                     // frames not delivered because client was slow
+    int tooBig;                           // non-zero once a frame didn't fit the socket buffer
+} unixClient;
+
+typedef struct _unixServer {
+  char *path;
+  int fd;
+  shmRing *ring;                          // memfd ring shared with memfd mode clients
+  size_t maxFrameSize;
+  unixClient clients[MAX_UNIX_CLIENTS];
+  int clientCount;
+  pthread_mutex_t lock;
+  pthread_t pt;
+} unixServer;
+
+unixServer *createUnixServer(const char *path, size_t maxFrameSize);
+void unixServerPublish(unixServer *us, const frameStore *frame);
+void destroyUnixServer(unixServer *us);
+void *unixThread(void *arg);
+
+#endif
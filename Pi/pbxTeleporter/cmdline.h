@@ -17,14 +17,81 @@
 
 #include <argp.h>
 
+#include "colorCorrect.h"
+
 // struct to hold parser results
 typedef struct _cmdline {
 	char *serial_port;
 	char *bind_ip;
 	int  listen_port;
 	int  send_port;
+	char *shm_name;                  // shared memory frame ring, NULL if disabled
+	int  shm_slots;
+	char *unix_path;                 // unix domain socket server, NULL if disabled
+	char *pipe_path;                 // raw video output, NULL if disabled
+	int  pipe_format;
+	int  pipe_width;
+	int  pipe_height;
+	int  pipe_fps;
+	int  rgbw_mode;
+	int  max_pixels;                 // pixel capacity of a frame, all channels together
+	int  arena_flags;                // ARENA_HUGEPAGES, ARENA_LOCKED
+	int  correct_enabled;            // non-zero if any color correction option was given
+	correction correct;              // command line correction, all channels
+	char *correct_path;              // per-channel correction file, NULL if none
+	char *map_path;                  // pixel map file, NULL if none
+	char *raster_path;               // x,y map for the rasterizer, NULL if disabled
+	int  raster_width;
+	int  raster_height;
+	int  raster_mode;                // RASTER_NEAREST or RASTER_SPLAT
+	char *raster_out;                // where the images go
+	int  raster_format;
+	int  keepalive;                  // --dedup repeat interval in ms, 0 if not deduplicating
+	int  metrics_port;               // Prometheus endpoint port, 0 if disabled
+	char *trace_path;                // Chrome trace output, NULL if not tracing
+	int  perf;                       // count cycles and instructions per frame
+	int  watchdog;                   // serial watchdog in ms, 0 to follow the frame rate, WATCHDOG_OFF
+	int  baud;                       // serial bit rate
+	int  rt_priority;                // SCHED_FIFO priority for the serial thread, 0 if off
+	int  ingest_cpu;                 // CPUs to pin the serial and transform threads to, -1 for any
+	int  send_cpu;
+	int  mlockall;                   // lock all memory
+	int  always_decode;              // decode every frame, even with nobody listening
 } commandline;
 
+// keys for options that have no short form
+enum {
+	OPT_SHM_SLOTS = 0x100,
+	OPT_PIPE_FORMAT,
+	OPT_PIPE_SIZE,
+	OPT_PIPE_FPS,
+	OPT_RGBW,
+	OPT_MAX_PIXELS,
+	OPT_HUGEPAGES,
+	OPT_MLOCK,
+	OPT_GAMMA,
+	OPT_BRIGHTNESS,
+	OPT_WHITE_POINT,
+	OPT_CORRECT,
+	OPT_MAP,
+	OPT_RASTER,
+	OPT_RASTER_SIZE,
+	OPT_RASTER_MODE,
+	OPT_RASTER_OUT,
+	OPT_RASTER_FORMAT,
+	OPT_DEDUP,
+	OPT_METRICS,
+	OPT_TRACE,
+	OPT_PERF,
+	OPT_WATCHDOG,
+	OPT_BAUD,
+	OPT_RT_PRIORITY,
+	OPT_INGEST_CPU,
+	OPT_SEND_CPU,
+	OPT_MLOCKALL,
+	OPT_ALWAYS_DECODE
+};
+
 extern struct argp argparser;
 
 #endif //__cmdline_h__
@@ -0,0 +1,52 @@
+/* colorCorrect.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Optional server side gamma, brightness and white point correction.
+ * Every channel gets a 256 entry lookup table per color element, built
+ * from its settings when they change.  Corrected frames are written to a
+ * separate buffer, so clients that want the raw data can still have it.
+ *
+ * Per-channel settings come from a correction file, reread on SIGHUP:
+ *
+ *   # channels   settings
+ *   all          gamma=2.2
+ *   0-7          brightness=0.5 white=1.0,0.85,0.7
+ *   12           gamma=2.8
+ *
+ * Each line starts from the channel's current settings, so later lines
+ * refine earlier ones.  white takes 3 or 4 (RGBW) scale factors.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __colorcorrect_h__
+#define __colorcorrect_h__
+
+#include <stdint.h>
+
+#include "frameStore.h"
+
+typedef struct {
+    float gamma;                          // 1.0 = linear
+    float brightness;                     // 0.0 to 1.0
+    float white[4];                       // per element scale, R, G, B, W
+} correction;
+
+typedef struct {
+    correction global;                    // settings from the command line
+    correction settings[MAX_CHANNELS];
+    uint8_t lut[MAX_CHANNELS][4][256];
+    uint8_t identity[MAX_CHANNELS];       // non-zero if the channel's tables do nothing
+    char *path;                           // correction file, NULL if none
+} colorCorrector;
+
+void correctionDefaults(correction *c);
+colorCorrector *createColorCorrector(const correction *global, const char *path);
+int colorCorrectReload(colorCorrector *cc);
+void colorCorrectFrame(colorCorrector *cc, const frameStore *src, frameStore *dst, uint8_t *buffer);
+void destroyColorCorrector(colorCorrector *cc);
+
+#endif /* __colorcorrect_h__ */
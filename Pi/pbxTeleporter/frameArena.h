@@ -0,0 +1,43 @@
+/* frameArena.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * One block of memory, sized at startup from --max-pixels, that holds all
+ * of the per-frame buffers.  It is touched (and optionally locked) up front
+ * so the serial thread never takes a page fault while building a frame.
+ * Buffers are carved out of it in order and never freed individually.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __framearena_h__
+#define __framearena_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// requested options
+#define ARENA_HUGEPAGES 0x01              // back the arena with huge pages if we can
+#define ARENA_LOCKED    0x02              // mlock() the arena
+
+// what we actually got
+#define ARENA_HUGETLB   0x10              // explicit huge pages (MAP_HUGETLB)
+#define ARENA_THP       0x20              // transparent huge pages were requested with madvise()
+
+#define ARENA_ALIGN     64                // cache line
+#define HUGEPAGE_SIZE   (2 * 1024 * 1024)
+
+typedef struct {
+  uint8_t *base;
+  size_t size;                            // bytes mapped
+  size_t used;                            // bytes handed out so far
+  int flags;                              // ARENA_* in effect
+} frameArena;
+
+frameArena *createFrameArena(size_t size, int flags);
+void *arenaAlloc(frameArena *arena, size_t size);
+void destroyFrameArena(frameArena *arena);
+
+#endif /* __framearena_h__ */
@@ -0,0 +1,51 @@
+/* frameQueue.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Hands completed frames from the serial thread to the transform thread.
+ * Triple buffered: the serial thread copies each frame into a free slot
+ * and swaps it in as the newest, and the transform thread swaps the newest
+ * out when it's ready for another.  Neither side waits for the other.  If
+ * the transform thread falls behind, it skips to the latest frame and the
+ * ones it missed are counted as dropped.  Other threads can wake the
+ * transform thread between frames, to answer a request from the frame it
+ * already has.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __framequeue_h__
+#define __framequeue_h__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "frameStore.h"
+#include "frameArena.h"
+
+#define FRAME_QUEUE_SLOTS 3
+
+typedef struct {
+    frameStore slots[FRAME_QUEUE_SLOTS];
+    int write;                            // slot the serial thread fills next
+    int ready;                            // newest complete frame
+    int read;                             // slot the transform thread is working on
+    int fresh;                            // ready holds a frame nobody has taken yet
+    int woken;                            // frameQueueWake() since the last take
+    int stopped;
+    uint64_t frames;                      // frames put
+    uint64_t dropped;                     // frames replaced before they were taken
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} frameQueue;
+
+int frameQueueInit(frameQueue *q, frameArena *arena, size_t capacity, uint32_t maxPixels);
+void frameQueuePut(frameQueue *q, const frameStore *fs);
+frameStore *frameQueueTake(frameQueue *q, int *woken);
+void frameQueueWake(frameQueue *q);
+void frameQueueStop(frameQueue *q);
+void frameQueueDestroy(frameQueue *q);
+
+#endif /* __framequeue_h__ */
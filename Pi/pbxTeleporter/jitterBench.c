@@ -0,0 +1,151 @@
+/* jitterBench.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Measures how late a serial reader wakes up when the machine is busy,
+ * with and without SCHED_FIFO, as a check on what --rt-priority buys.
+ *
+ * A writer thread at high SCHED_FIFO priority puts a timestamp into a
+ * pty every JITTER_PERIOD_US.  The reader does what readSerial() does,
+ * read() and then poll() when there's nothing there, and records how long
+ * each timestamp took to arrive.  Busy loops at normal priority compete
+ * with it for the CPU.  The run is done once with the reader at normal
+ * priority and once under SCHED_FIFO.
+ *
+ * A pty is delivered by a kworker at normal priority, so some of the tail
+ * that's left under SCHED_FIFO is the pty, not the reader.  A real UART's
+ * driver runs in its own IRQ thread.
+ *
+ * usage: jitterBench [busy loops per CPU] [rt priority]   (default 4 and 50)
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <termios.h>
+
+#define JITTER_SAMPLES    3000            // wakeups timed per run
+#define JITTER_PERIOD_US  2000            // time between writes
+#define WRITER_PRIORITY   80              // above any reader priority we test
+
+static int master, slave;
+static volatile int busyFlag = 1;
+
+static uint64_t nanoTime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *busyThread(void *arg) {
+	volatile uint64_t n = 0;
+	while (busyFlag) n++;
+	return NULL;
+}
+
+static void *writerThread(void *arg) {
+	struct sched_param sp = { .sched_priority = WRITER_PRIORITY };
+
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0) {
+		printf("jitterBench: writer can't use SCHED_FIFO, wakeups will be timed late\n");
+	}
+	for (int i = 0; i < JITTER_SAMPLES; i++) {
+		usleep(JITTER_PERIOD_US);
+		uint64_t t = nanoTime();
+		if (write(master, &t, sizeof(t)) != sizeof(t)) break;
+	}
+	return NULL;
+}
+
+static int compareTimes(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x < y) ? -1 : (x > y);
+}
+
+// time JITTER_SAMPLES wakeups with the reader at priority (0 for normal)
+static void runReader(int priority) {
+	static uint64_t late[JITTER_SAMPLES];
+	struct sched_param sp = { .sched_priority = priority };
+	pthread_t writer;
+
+	if (priority && pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0) {
+		printf("jitterBench: SCHED_FIFO refused, needs root or CAP_SYS_NICE\n");
+		return;
+	}
+
+	pthread_create(&writer, NULL, writerThread, NULL);
+	for (int i = 0; i < JITTER_SAMPLES; ) {
+		struct pollfd p = { slave, POLLIN, 0 };
+		uint64_t t;
+
+		if (read(slave, &t, sizeof(t)) == sizeof(t)) {
+			late[i++] = nanoTime() - t;
+			continue;
+		}
+		poll(&p, 1, 1000);
+	}
+	pthread_join(writer, NULL);
+
+	sp.sched_priority = 0;
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+
+	qsort(late, JITTER_SAMPLES, sizeof(uint64_t), compareTimes);
+	printf("    %-12s p50 %6.0f us  p99 %6.0f us  p99.9 %6.0f us  max %6.0f us\n",
+		priority ? "SCHED_FIFO" : "SCHED_OTHER",
+		late[JITTER_SAMPLES / 2] / 1e3, late[JITTER_SAMPLES * 99 / 100] / 1e3,
+		late[JITTER_SAMPLES * 999 / 1000] / 1e3, late[JITTER_SAMPLES - 1] / 1e3);
+}
+
+int main(int argc, char *argv[]) {
+	int busyPerCpu = (argc > 1) ? atoi(argv[1]) : 4;
+	int priority = (argc > 2) ? atoi(argv[2]) : 50;
+	int cpus = sysconf(_SC_NPROCESSORS_ONLN), busy;
+	struct termios t;
+	pthread_t *loops;
+
+	if (busyPerCpu < 0 || priority < 1 || priority >= WRITER_PRIORITY) {
+		printf("usage: jitterBench [busy loops per CPU] [rt priority 1-%d]\n", WRITER_PRIORITY - 1);
+		return 1;
+	}
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		printf("jitterBench: unable to open a pty\n");
+		return 1;
+	}
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+	tcgetattr(slave, &t);
+	cfmakeraw(&t);
+	tcsetattr(slave, TCSANOW, &t);
+	tcgetattr(master, &t);
+	cfmakeraw(&t);
+	tcsetattr(master, TCSANOW, &t);
+
+	busy = busyPerCpu * cpus;
+	loops = (pthread_t *) calloc(busy ? busy : 1, sizeof(pthread_t));
+	for (int i = 0; i < busy; i++) pthread_create(&loops[i], NULL, busyThread, NULL);
+
+	printf("jitterBench: %d wakeups every %d us, %d CPUs, %d busy loops\n",
+		JITTER_SAMPLES, JITTER_PERIOD_US, cpus, busy);
+	runReader(0);
+	runReader(priority);
+
+	busyFlag = 0;
+	for (int i = 0; i < busy; i++) pthread_join(loops[i], NULL);
+	free(loops);
+	close(slave);
+	close(master);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/* metrics.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Counters and gauges for watching a running bridge, served as Prometheus
+ * text by a small HTTP listener.
+ *
+ * Each thread has its own cache line aligned block of values, and only
+ * that thread ever writes to it, so an update is a load, an add and a
+ * relaxed store -- no locked instructions and no shared cache lines.
+ * The HTTP thread adds up every thread's block when it's scraped.
+ * Gauges are set by the one thread that owns them and summed the same
+ * way, which works because the other threads leave theirs at zero.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __metrics_h__
+#define __metrics_h__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#define DEFAULT_METRICS_PORT 9180
+
+enum Metric {
+  M_SERIAL_BYTES = 0,                     // bytes read from the serial port
+  M_RESYNCS,                              // times we lost the framing and hunted for UPXL
+  M_RECORDS,                              // channel records read
+  M_CRC_FAILURES,                         // channel records with a bad CRC
+  M_SERIAL_STALLS,                        // times the watchdog reset a stalled or garbled stream
+  M_UART_OVERRUNS,                        // UART line errors since we opened the port
+  M_UART_FRAMING,
+  M_UART_PARITY,
+  M_UART_BREAKS,
+  M_UART_BUFFER_OVERRUNS,
+  M_FRAMES_RECEIVED,                      // DRAW_ALL commands
+  M_FRAMES_SKIPPED,                       // frames replaced before the transform thread got to them
+  M_FRAMES_PUBLISHED,                     // frames sent to the outputs
+  M_FRAMES_DEDUPED,                       // unchanged frames not sent
+  M_FRAMES_IDLE,                          // frames not decoded because nobody was listening
+  M_UDP_REQUESTS,                         // frame requests from UDP clients
+  M_UDP_SENDS,                            // frames sent to UDP clients
+  M_UDP_SEND_ERRORS,
+  M_UDP_BYTES_SENT,
+  M_UNIX_SENDS,                           // frames sent to unix socket clients
+  M_UNIX_DROPS,                           // frames a slow unix socket client missed
+  M_PIPE_FRAMES,                          // frames written to video outputs
+  M_PIPE_DROPS,                           // frames a slow video reader missed
+  M_HTTP_REQUESTS,
+  M_UDP_CLIENTS,                          // gauge: UDP clients answered with the last frame
+  M_UNIX_CLIENTS,                         // gauge: connected unix socket clients
+  M_FRAME_PIXELS,                         // gauge: pixels in the last frame published
+  M_SERIAL_RECOVERY_MS,                   // gauge: data resuming -> first frame, after the last stall
+  METRIC_COUNT
+};
+
+// one block per thread that updates metrics
+enum MetricThread {
+  METRIC_THREAD_OTHER = 0,                // anything that didn't register
+  METRIC_THREAD_SERIAL,
+  METRIC_THREAD_TRANSFORM,
+  METRIC_THREAD_UDP,
+  METRIC_THREAD_UNIX,
+  METRIC_THREAD_HTTP,
+  METRIC_THREADS
+};
+
+typedef struct {
+    uint64_t value[METRIC_COUNT];
+} __attribute__((aligned(64))) metricBlock;
+
+extern metricBlock metricBlocks[METRIC_THREADS];
+extern __thread metricBlock *threadMetrics;
+
+// only the owning thread writes its block, so a plain add is enough.  The
+// relaxed store just keeps the compiler from tearing or caching it.
+static inline void metricAdd(int m, uint64_t n) {
+	uint64_t *v = &threadMetrics->value[m];
+	__atomic_store_n(v, *v + n, __ATOMIC_RELAXED);
+}
+
+static inline void metricSet(int m, uint64_t n) {
+	__atomic_store_n(&threadMetrics->value[m], n, __ATOMIC_RELAXED);
+}
+
+void metricsThread(int thread);
+uint64_t metricRead(int m);
+
+typedef struct {
+    int fd;
+    struct sockaddr_in addr;
+    pthread_t pt;
+} metricsServer;
+
+metricsServer *createMetricsServer(const char *bind_addr, int port);
+void destroyMetricsServer(metricsServer *ms);
+
+#endif /* __metrics_h__ */
@@ -23,11 +23,33 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <poll.h>
 #include <linux/serial.h>
 #include <errno.h>
 
 #include "pbxSerial.h"
 
+// The kernel's termios, with the speeds as plain numbers.  It lives in
+// asm/termbits.h, which can't be included alongside glibc's termios.h,
+// so here's our own copy for TCGETS2/TCSETS2.
+struct termios2 {
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[19];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+
+#ifndef BOTHER
+#define BOTHER 0010000                    // c_cflag: speed is in c_ispeed/c_ospeed
+#endif
+#ifndef IBSHIFT
+#define IBSHIFT 16                        // input speed bits are this far above the output's
+#endif
+
 // lookup tables for serial rates.  Where was the mighty power of hardware
 // abstraction when they were designing this interface?
 int _serialRate[] = {50,75,110,134,150,200,300,600,1200,1800,2400,4800,9600,19200,38400,57600,115200,230400,460800,500000,
@@ -53,8 +75,32 @@ speed_t hideousSerialSpeedFinder(int requested) {
 	return speed;
 }
 
+// set a rate that isn't in the table.  Returns 0, or -1 if the driver
+// won't have it.
+int setOtherSpeed(int fd, int speed) {
+	struct termios2 options;
+
+	if (ioctl(fd, TCGETS2, &options) < 0) return -1;
+
+	options.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	options.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+	options.c_ispeed = speed;
+	options.c_ospeed = speed;
+	return ioctl(fd, TCSETS2, &options);
+}
+
+// the rate the driver says it's actually using, which may be the
+// nearest one its clock can make.  Returns -1 if it won't say.
+int serialSpeed(const int fd) {
+	struct termios2 options;
+
+	if (ioctl(fd, TCGETS2, &options) < 0) return -1;
+	return (int) options.c_ispeed;
+}
+
 //
-// Open and iniialize serial port
+// Open and iniialize serial port.  Rates in the table are set the usual
+// way; anything else goes to the driver as is, through termios2.
 //
 int serialOpen(const char *device,int speed)
 {
@@ -65,11 +111,8 @@ int serialOpen(const char *device,int speed)
 
 // convert from desired baud rate to weird historical artifact
   baudRate = hideousSerialSpeedFinder(speed);
-  if (baudRate < 0) {
-	  return - 1;
-  }
 
-// attempt to open the seial port for blocking IO
+// attempt to open the seial port
 //  fd = open (device, O_RDWR | O_NOCTTY | O_NDELAY | O_NONBLOCK);
   fd = open (device, O_RDWR | O_NOCTTY);
   if (fd == -1) {
@@ -78,13 +121,17 @@ int serialOpen(const char *device,int speed)
   }
 
 // Set basic serial port options
-// speed, parity, stop bits, etc.
-  fcntl (fd, F_SETFL, O_RDWR);
+// speed, parity, stop bits, etc.  Reads don't block, so the caller can
+// put a time limit on waiting for data with serialWait.
+  fcntl (fd, F_SETFL, O_RDWR | O_NONBLOCK);
   tcgetattr (fd, &options) ;
 
   cfmakeraw   (&options) ;
-  cfsetispeed (&options, baudRate);
-  cfsetospeed (&options, baudRate);
+  if (baudRate != (speed_t) -1) {
+    cfsetispeed (&options, baudRate);
+    cfsetospeed (&options, baudRate);
+    options.c_cflag &= ~CIBAUD;  // input follows output, even if a BOTHER rate was set before
+  }
 
   options.c_cflag |= (CLOCAL | CREAD);
   options.c_cflag &= ~PARENB;
@@ -95,10 +142,16 @@ int serialOpen(const char *device,int speed)
   options.c_oflag &= ~OPOST;
 
   options.c_cc [VMIN]  =  1;
-  options.c_cc [VTIME] =  0;  // block 'till one byte is ready
+  options.c_cc [VTIME] =  0;
 
   tcsetattr (fd, TCSANOW, &options) ;
 
+  if ((baudRate == (speed_t) -1) && (setOtherSpeed(fd, speed) < 0)) {
+    printf("Unable to set %i bps: %s\n", speed, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
 // configure the port for low latency.  You may need to
 // be root on some systems for this to have any effect, but
 // nonetheless...
@@ -129,6 +182,36 @@ int serialAvailable (const int fd) {
   return size;
 }
 
+// wait up to timeout ms (-1 for as long as it takes) for data.  Returns 1
+// if there's data to read or a signal cut the wait short, 0 on timeout,
+// and -1 if the device has gone away.
+int serialWait(const int fd, int timeout) {
+	struct pollfd pfd;
+	int n;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	n = poll(&pfd, 1, timeout);
+	if (n < 0) return (errno == EINTR) ? 1 : -1;
+	if (n == 0) return 0;
+	return (pfd.revents & POLLIN) ? 1 : -1;
+}
+
+// read the UART's line error counts.  Returns 0, or -1 if the driver
+// doesn't keep them (ptys and some USB adapters don't).
+int serialErrors(const int fd, serialErrorCounts *counts) {
+	struct serial_icounter_struct icount;
+
+	if (ioctl(fd, TIOCGICOUNT, &icount) < 0) return -1;
+
+	counts->overrun = icount.overrun;
+	counts->frame = icount.frame;
+	counts->parity = icount.parity;
+	counts->brk = icount.brk;
+	counts->bufOverrun = icount.buf_overrun;
+	return 0;
+}
+
 // flush tx/rx serial buffers
 void serialFlush(const int fd) {
   tcflush(fd, TCIOFLUSH);
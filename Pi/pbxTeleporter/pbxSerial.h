@@ -15,16 +15,28 @@
 #ifndef __serial_h__
 #define __serial_h__
 
+#include <stdint.h>
+
+// UART line error counts, from TIOCGICOUNT
+typedef struct {
+    uint32_t overrun;                     // characters lost in the UART's FIFO
+    uint32_t frame;                       // framing errors (bad stop bit, usually wrong speed)
+    uint32_t parity;
+    uint32_t brk;                         // breaks
+    uint32_t bufOverrun;                  // characters lost because the tty buffer was full
+} serialErrorCounts;
+
 extern int serialOpen(const char *device, const int baud);
 extern int serialAvailable(const int fd);
+extern int serialSpeed(const int fd);
+extern int serialWait(const int fd, int timeout);
+extern int serialErrors(const int fd, serialErrorCounts *counts);
 extern void serialFlush(const int fd);
 extern void serialClose(const int fd);
 
-// Read a single byte from the serial device
-// read() will block for the time set in serialOpen.
-// BUGBUG - ignores timeout errors, so
-// check w/serialAvailable to be sure data is ready if
-// that is of concern.
+// Read from the serial device.  The port is non-blocking, so these
+// return -1 (EAGAIN) if nothing has arrived; use serialWait to wait for
+// data.
 #define serialGetbyte(fd,b) read(fd,b,1)
 #define serialGetbytes(fd,b,n) read(fd,b,n)
 
@@ -0,0 +1,62 @@
+/* perfCounters.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Hardware performance counters per frame.  With --perf, the serial and
+ * transform threads each open a perf_event group counting their own
+ * cycles, instructions, cache misses and context switches.  The serial
+ * thread reads its group at every DRAW_ALL and the transform thread after
+ * publishing each frame, so the totals divide out to cycles per frame
+ * and instructions per cycle for the ingest and publish stages.
+ *
+ * Reading a group is one read() per frame per thread.  Events the kernel
+ * or CPU won't give us (VMs often have no hardware counters, and
+ * perf_event_paranoid may rule out kernel time) are left out, and if
+ * none can be opened the stage just isn't counted.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __perfCounters_h__
+#define __perfCounters_h__
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum PerfEvent {
+  PERF_CYCLES = 0,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_MISSES,
+  PERF_CONTEXT_SWITCHES,
+  PERF_EVENTS
+};
+
+enum PerfStage {
+  PERF_INGEST = 0,                        // serial thread, DRAW_ALL to DRAW_ALL
+  PERF_PUBLISH,                           // transform thread, one frame's outputs
+  PERF_STAGES
+};
+
+typedef struct {
+    int fd[PERF_EVENTS];                  // -1 if the event isn't counted
+    int slot[PERF_EVENTS];                // position in the group read, -1 if not counted
+    int leader;                           // group leader's fd, -1 if the stage is off
+    int events;                           // events in the group
+    int kernel;                           // non-zero if kernel time is counted too
+    uint64_t last[PERF_EVENTS];           // counter values at the last sample
+    uint64_t total[PERF_EVENTS];          // counted since the first sample
+    uint64_t frames;                      // samples taken
+} perfStage;
+
+extern int perfEnabled;
+extern perfStage perfStages[PERF_STAGES];
+
+void perfThread(int stage);
+void perfSample(int stage);
+void perfDump(FILE *f);
+size_t perfFormat(char *buf, size_t size);
+void perfClose(void);
+
+#endif /* __perfCounters_h__ */
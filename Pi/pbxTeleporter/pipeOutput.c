@@ -0,0 +1,343 @@
+/* pipeOutput.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Raw video (rgb24/Y4M) output to stdout or a FIFO.  Each frame is built
+ * once in a ring of page aligned slots and handed to the pipe with
+ * vmsplice(), so the kernel references our pages instead of copying them
+ * into pipe buffers.  We never queue more frames than the ring has slots,
+ * so a slot is not reused while the reader can still see it.
+ *
+ * Building the frame in the ring costs one copy (or conversion) per frame,
+ * about 11us for 100K RGB pixels on a desktop x86.  We can't vmsplice from
+ * the frame slots themselves, because the serial thread reuses them as
+ * soon as the next frame is done, while the pipe reader may still be
+ * holding the pages.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "pipeOutput.h"
+#include "metrics.h"
+#include "pixelKernels.h"
+
+#define PIPE_CAPACITY_PAGES 16            // pipe size we ask for, in pages
+#define PIPE_RING_SLOTS     8             // frame slots in the output ring
+#define Y4M_FRAME_TAG       "FRAME\n"
+#define FOLD_PIXELS         256           // RGBW pixels folded to RGB at a time for Y4M
+
+static int stdoutFd = -1;                 // original stdout, if we're writing video to it
+
+// Move the real stdout out of the way so that status messages can't end up
+// in the middle of the video stream.  printf() goes to stderr from here on.
+int pipeSetStdout(void) {
+	fflush(stdout);
+	stdoutFd = dup(STDOUT_FILENO);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+	return stdoutFd;
+}
+
+// open the output if it isn't already.  For a FIFO with no reader
+// this fails quietly and we try again on the next frame.
+static int pipeOpen(pipeOutput *po) {
+	struct stat st;
+	char header[80];
+	int n;
+
+	if (po->fd >= 0) return 1;
+
+	if (strcmp(po->path, "-") == 0) {
+		if (stdoutFd < 0) return 0;     // reader went away for good
+		po->fd = stdoutFd;
+		stdoutFd = -1;
+	}
+	else {
+		po->fd = open(po->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+		if (po->fd < 0) return 0;
+	}
+
+	fstat(po->fd, &st);
+	po->isPipe = S_ISFIFO(st.st_mode);
+	if (po->isPipe) {
+		size_t size = PIPE_CAPACITY_PAGES * sysconf(_SC_PAGESIZE);
+		if (size < 2 * po->slotSize) size = 2 * po->slotSize;
+		fcntl(po->fd, F_SETFL, fcntl(po->fd, F_GETFL) | O_NONBLOCK);
+		fcntl(po->fd, F_SETPIPE_SZ, size);
+	}
+
+	po->pending = NULL;
+	po->pendingLen = 0;
+
+	if (po->format == PIPE_FORMAT_Y4M) {
+		n = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+			po->width, po->height, po->fps);
+		if (write(po->fd, header, n) != n) {
+			close(po->fd);
+			po->fd = -1;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void pipeClose(pipeOutput *po) {
+	close(po->fd);
+	po->fd = -1;
+	po->pending = NULL;
+	po->pendingLen = 0;
+}
+
+// push as much of the pending frame as the pipe will take without
+// blocking.  Returns 1 when the whole frame is gone.
+static int pipeFlush(pipeOutput *po) {
+	struct iovec iov;
+	ssize_t res;
+
+	while (po->pendingLen) {
+		if (po->isPipe) {
+			iov.iov_base = (void *) po->pending;
+			iov.iov_len = po->pendingLen;
+			res = vmsplice(po->fd, &iov, 1, SPLICE_F_NONBLOCK);
+		}
+		else {
+			res = write(po->fd, po->pending, po->pendingLen);
+		}
+
+		if (res < 0) {
+			if (errno == EAGAIN) return 0;
+			if (errno == EINTR) continue;
+			pipeClose(po);              // EPIPE -- reader has gone away
+			return 0;
+		}
+		po->pending += res;
+		po->pendingLen -= res;
+	}
+	return 1;
+}
+
+// returns 1 if the pipe can take another frame of the given size without
+// blocking, and without the reader still holding the slot we're about to reuse.
+// A frame bigger than the pipe (pipe-max-size is 1M for normal users) goes
+// into an empty pipe, and the rest of it follows as the reader drains it.
+static int pipeHasRoom(pipeOutput *po, size_t size) {
+	int queued = 0, capacity;
+
+	if (!po->isPipe) return 1;
+
+	capacity = fcntl(po->fd, F_GETPIPE_SZ);
+	ioctl(po->fd, FIONREAD, &queued);
+	if (queued && ((size_t) queued + size > (size_t) capacity)) return 0;
+
+	return ((queued + size - 1) / size) + 2 <= (size_t) po->slotCount;
+}
+
+// BT.601 limited range RGB -> planar YUV 4:4:4, for grid positions
+// at to at + pixels.  out has planes of area pixels each.
+static void toY4M(const uint8_t *rgb, size_t pixels, uint8_t *out, size_t at, size_t area) {
+	uint8_t *y = out + at, *u = out + area + at, *v = out + 2 * area + at;
+
+	for (size_t i = 0; i < pixels; i++, rgb += 3) {
+		int r = rgb[0], g = rgb[1], b = rgb[2];
+		y[i] = (uint8_t) ((( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16);
+		u[i] = (uint8_t) (((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128);
+		v[i] = (uint8_t) (((112 * r -  94 * g -  18 * b + 128) >> 8) + 128);
+	}
+}
+
+// grid positions from at to the end are black
+static void blankY4M(uint8_t *out, size_t at, size_t area) {
+	memset(out + at, 16, area - at);
+	memset(out + area + at, 128, area - at);
+	memset(out + 2 * area + at, 128, area - at);
+}
+
+pipeOutput *createPipeOutput(const char *path, int format, int width, int height, int fps, size_t maxFrameSize) {
+	pipeOutput *po;
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+	po = (pipeOutput *) calloc(1, sizeof(pipeOutput));
+	po->path = strdup(path);
+	po->fd = -1;
+	po->format = format;
+	po->width = width;
+	po->height = height;
+	po->fps = fps;
+
+	if (format == PIPE_FORMAT_Y4M) {
+		po->frameSize = strlen(Y4M_FRAME_TAG) + (size_t) width * height * 3;
+	}
+	else if (width && height) {
+		po->frameSize = (size_t) width * height * 3;
+	}
+	else {
+		po->frameSize = 0;
+	}
+
+	po->slotSize = ((po->frameSize ? po->frameSize : maxFrameSize) + page - 1) & ~(page - 1);
+	po->slotCount = PIPE_RING_SLOTS;
+	po->ringSize = po->slotSize * po->slotCount;
+	po->ring = mmap(NULL, po->ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (po->ring == MAP_FAILED) {
+		printf("pbxTeleporter: unable to allocate pipe output buffers\n");
+		free(po->path);
+		free(po);
+		return NULL;
+	}
+
+// a reader closing the pipe should cost us an EPIPE, not our life
+	signal(SIGPIPE, SIG_IGN);
+	pipeOpen(po);
+
+	return po;
+}
+
+// find a slot for a frame of size bytes.  Returns NULL, and counts the
+// drop, if the reader isn't keeping up.
+static uint8_t *pipeSlot(pipeOutput *po, size_t size) {
+	uint8_t *slot;
+
+	if (!pipeOpen(po) || !pipeFlush(po) || size == 0 || !pipeHasRoom(po, size)) {
+		po->dropped++;
+		metricAdd(M_PIPE_DROPS,1);
+		return NULL;
+	}
+
+	slot = po->ring + (po->frameSeq % po->slotCount) * po->slotSize;
+	po->frameSeq++;
+	return slot;
+}
+
+static void pipeSend(pipeOutput *po, uint8_t *slot, size_t size) {
+	po->pending = slot;
+	po->pendingLen = size;
+	pipeFlush(po);
+	po->written++;
+	metricAdd(M_PIPE_FRAMES,1);
+}
+
+// the size of a frame of len bytes of RGB on the wire
+static size_t pipeFrameSize(pipeOutput *po, size_t len) {
+	size_t size = po->frameSize ? po->frameSize : len;
+	return (size > po->slotSize) ? po->slotSize : size;
+}
+
+// write one completed frame of RGB pixels.  Never blocks; if the reader
+// isn't keeping up, the frame is dropped.
+void pipeOutputWrite(pipeOutput *po, const uint8_t *frame, size_t len) {
+	size_t size = pipeFrameSize(po, len);
+	uint8_t *slot = pipeSlot(po, size);
+
+	if (slot == NULL) return;
+
+	if (po->format == PIPE_FORMAT_Y4M) {
+		size_t area = (size_t) po->width * po->height;
+		size_t pixels = (len / 3 < area) ? len / 3 : area;
+		uint8_t *planes = slot + strlen(Y4M_FRAME_TAG);
+
+		memcpy(slot, Y4M_FRAME_TAG, strlen(Y4M_FRAME_TAG));
+		toY4M(frame, pixels, planes, 0, area);
+		blankY4M(planes, pixels, area);
+	}
+	else if (len >= size) {
+		memcpy(slot, frame, size);
+	}
+	else {
+		memcpy(slot, frame, len);
+		memset(slot + len, 0, size - len);
+	}
+
+	pipeSend(po, slot, size);
+}
+
+// write a frame straight from its channel directory, folding RGBW
+// channels to RGB on the way.
+void pipeOutputWriteFrame(pipeOutput *po, const frameStore *fs) {
+	size_t len = 0, size, at = 0;
+	uint8_t *slot;
+
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		len += (size_t) fs->dir[i].pixels * 3;
+	}
+	size = pipeFrameSize(po, len);
+	slot = pipeSlot(po, size);
+	if (slot == NULL) return;
+
+	if (po->format == PIPE_FORMAT_Y4M) {
+		size_t area = (size_t) po->width * po->height;
+		uint8_t *planes = slot + strlen(Y4M_FRAME_TAG);
+		uint8_t rgb[FOLD_PIXELS * 3];
+
+		memcpy(slot, Y4M_FRAME_TAG, strlen(Y4M_FRAME_TAG));
+		for (int i = 0; i < MAX_CHANNELS && at < area; i++) {
+			const channelEntry *e = &fs->dir[i];
+			const uint8_t *src = fs->data + e->offset;
+			size_t left = e->pixels;
+
+			if (e->length == 0) continue;
+			if (left > area - at) left = area - at;
+
+			if (e->elements == 4) {
+				while (left) {
+					uint32_t n = (left > FOLD_PIXELS) ? FOLD_PIXELS : left;
+					rgbwToRgb(src, rgb, n);
+					toY4M(rgb, n, planes, at, area);
+					src += n * 4;
+					at += n;
+					left -= n;
+				}
+			}
+			else {
+				toY4M(src, left, planes, at, area);
+				at += left;
+			}
+		}
+		blankY4M(planes, at, area);
+	}
+	else {
+		for (int i = 0; i < MAX_CHANNELS && at < size; i++) {
+			const channelEntry *e = &fs->dir[i];
+			size_t pixels = e->pixels;
+
+			if (e->length == 0) continue;
+			if (pixels > (size - at) / 3) pixels = (size - at) / 3;
+
+			if (e->elements == 4) {
+				rgbwToRgb(fs->data + e->offset, slot + at, pixels);
+			}
+			else {
+				memcpy(slot + at, fs->data + e->offset, pixels * 3);
+			}
+			at += pixels * 3;
+		}
+		memset(slot + at, 0, size - at);
+	}
+
+	pipeSend(po, slot, size);
+}
+
+void destroyPipeOutput(pipeOutput *po) {
+	if (po == NULL) return;
+
+	printf("    Pipe output %s: %llu frames written, %llu dropped\n", po->path,
+		(unsigned long long) po->written, (unsigned long long) po->dropped);
+	if (po->fd >= 0) close(po->fd);
+	munmap(po->ring, po->ringSize);
+	free(po->path);
+	free(po);
+}
@@ -0,0 +1,216 @@
+/* pixelBench.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Times the per-frame pixel work on this machine, so the numbers quoted
+ * for it can be checked: the ingest and output kernels, reading an APA102
+ * channel the way the bridge used to and the way it does now, and drawing
+ * frames as images with the rasterizer.  "make bench" builds this twice,
+ * once with the SSSE3/NEON kernels and once with -DPIXEL_KERNELS_SCALAR,
+ * and runs both.
+ *
+ * Each case is run until it has taken BENCH_RUN_NS, a few times over,
+ * and the fastest run is reported, which keeps the numbers steady on a
+ * machine that's doing other things.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "pixelKernels.h"
+#include "frameStore.h"
+#include "pixelRaster.h"
+
+#define BENCH_RUN_NS  50000000            // time per run of a case
+#define BENCH_RUNS    5                   // runs per case, fastest one counts
+#define BENCH_PIXELS  4096                // a full expander channel's worth, give or take
+#define BENCH_SHORT   30                  // a short strip, mostly tail handling
+#define RASTER_LEDS   65536               // most LEDs in a raster case
+#define RASTER_CHANNEL 4096               // LEDs per channel in raster frames
+
+static uint8_t src[BENCH_PIXELS * 4];
+static uint8_t dst[BENCH_PIXELS * 4];
+static uint8_t bri[BENCH_PIXELS];
+static uint16_t hdr[BENCH_PIXELS * 4];
+static uint8_t lut[4][256];
+static volatile uint64_t sink;            // keeps results from being optimized away
+
+static uint8_t frameData[RASTER_LEDS * 3];
+static uint8_t frameBrightness[RASTER_LEDS];
+static frameStore frame;
+static pixelRaster *raster;
+static int wire[2];                       // pipe standing in for the serial port
+
+static uint64_t nanoTime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// one benchmark case.  count is pixels, or bytes for the whole-frame cases.
+typedef struct {
+	const char *name;
+	void (*run)(uint32_t count);
+} benchCase;
+
+static void runRgbw(uint32_t count)       { rgbwToRgb(src, dst, count); }
+static void runApa102(uint32_t count)     { apa102ToRgb(src, dst, count); }
+static void runBrightness(uint32_t count) { apa102Brightness(src, bri, count); }
+static void runHdr(uint32_t count)        { expandHdr(src, bri, hdr, count, 3); }
+static void runHdrFull(uint32_t count)    { expandHdr(src, NULL, hdr, count, 3); }
+static void runLut(uint32_t count)        { applyLut(src, dst, count, 3, (const uint8_t (*)[256]) lut); }
+static void runHash(uint32_t count)       { sink += hashBytes(src, count * 3, 0); }
+static void runCrc(uint32_t count)        { sink += crc32Update(CRC32_INIT, src, count * 4); }
+static void runRaster(uint32_t count)     { sink += pixelRasterFrame(raster, &frame)[0]; }
+
+// the APA102 channel loop as it was: a read() for the brightness byte,
+// then one for each color, the way readOneByte() and readBytes() did it
+static void runApaPerByte(uint32_t count) {
+	uint8_t *p = dst, b;
+
+	if (write(wire[1], src, count * 4) != count * 4) return;
+	for (uint32_t i = 0; i < count; i++, p += 3) {
+		if (read(wire[0], &b, 1) != 1) return;
+		for (int e = 0; e < 3; e++) {
+			if (read(wire[0], p + e, 1) != 1) return;
+		}
+	}
+}
+
+// and as it is now: the whole channel in one read(), then the kernels
+static void runApaBulk(uint32_t count) {
+	uint8_t in[BENCH_PIXELS * 4];
+
+	if (write(wire[1], src, count * 4) != count * 4) return;
+	if (read(wire[0], in, count * 4) != count * 4) return;
+	apa102ToRgb(in, dst, count);
+	apa102Brightness(in, bri, count);
+}
+
+static const benchCase cases[] = {
+	{ "rgbw to rgb",       runRgbw },
+	{ "apa102 to rgb",     runApa102 },
+	{ "apa102 brightness", runBrightness },
+	{ "hdr, apa102",       runHdr },
+	{ "hdr, full",         runHdrFull },
+	{ "color lut",         runLut },
+	{ "frame hash",        runHash },
+	{ "record crc",        runCrc },
+};
+
+static const benchCase ingestCases[] = {
+	{ "read per byte",     runApaPerByte },
+	{ "bulk read+kernels", runApaBulk },
+};
+
+// nanoseconds per call of c with count pixels, best of BENCH_RUNS
+static double timeCase(const benchCase *c, uint32_t count) {
+	double best = 0;
+
+	for (int r = 0; r < BENCH_RUNS; r++) {
+		uint64_t start = nanoTime(), elapsed, calls = 0;
+		do {
+			for (int i = 0; i < 64; i++) c->run(count);
+			calls += 64;
+			elapsed = nanoTime() - start;
+		} while (elapsed < BENCH_RUN_NS);
+
+		double ns = (double) elapsed / calls;
+		if (r == 0 || ns < best) best = ns;
+	}
+	sink += dst[0] + bri[0] + hdr[0];
+	return best;
+}
+
+// a square serpentine matrix of leds pixels, in a temporary map file
+static void writeSerpentine(const char *path, uint32_t leds) {
+	FILE *f = fopen(path, "w");
+	uint32_t side = 1;
+
+	while (side * side < leds) side++;
+	for (uint32_t i = 0; i < leds; i++) {
+		uint32_t y = i / side, x = i % side;
+		fprintf(f, "%u %u\n", (y & 1) ? side - 1 - x : x, y);
+	}
+	fclose(f);
+}
+
+// a frame of leds pixels of noise, in channels of RASTER_CHANNEL
+static void fillFrame(uint32_t leds) {
+	frameStoreInit(&frame, frameData, sizeof(frameData), frameBrightness, RASTER_LEDS);
+	for (uint8_t ch = 0; leds; ch++) {
+		uint16_t pixels = (leds > RASTER_CHANNEL) ? RASTER_CHANNEL : leds;
+		uint8_t *p = frameStoreChannel(&frame, ch, pixels, 3, PROTOCOL_WS2812);
+		for (uint32_t i = 0; i < pixels * 3u; i++) p[i] = rand();
+		frame.received |= 1ULL << ch;
+		leds -= pixels;
+	}
+	frameStoreComplete(&frame);
+}
+
+// time the rasterizer in both modes for one map size
+static void benchRaster(uint32_t leds, int size) {
+	static const benchCase rasterCase = { "raster", runRaster };
+	char path[] = "/tmp/pixelBenchXXXXXX";
+	double ns[2] = { 0, 0 };
+	int fd = mkstemp(path);
+
+	if (fd < 0) return;
+	close(fd);
+	writeSerpentine(path, leds);
+	fillFrame(leds);
+
+	for (int mode = RASTER_NEAREST; mode <= RASTER_SPLAT; mode++) {
+		raster = createPixelRaster(path, size, size, mode);
+		if (raster == NULL) break;
+		ns[mode] = timeCase(&rasterCase, 0);
+		destroyPixelRaster(raster);
+	}
+	unlink(path);
+
+	printf("    %5uK leds %4dx%-4d  %9.1f us %9.1f us\n", leds / 1024, size, size,
+		ns[RASTER_NEAREST] / 1000.0, ns[RASTER_SPLAT] / 1000.0);
+}
+
+int main(int argc, char **argv) {
+	pixelKernelsInit();
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(src); i++) src[i] = rand();
+	for (int e = 0; e < 4; e++) {
+		for (int v = 0; v < 256; v++) lut[e][v] = 255 - v;
+	}
+	apa102Brightness(src, bri, BENCH_PIXELS);
+
+	printf("pixelBench: %s kernels\n", pixelKernelsName());
+	printf("    %-20s %10s %10s\n", "", "4096 px", "30 px");
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		double big = timeCase(&cases[i], BENCH_PIXELS);
+		double small = timeCase(&cases[i], BENCH_SHORT);
+		printf("    %-20s %7.2f us %7.1f ns\n", cases[i].name, big / 1000.0, small);
+	}
+
+	printf("    apa102 channel from a pipe, %d px, including the write that fills it\n", BENCH_PIXELS);
+	if (pipe(wire) == 0) {
+		for (size_t i = 0; i < sizeof(ingestCases) / sizeof(ingestCases[0]); i++) {
+			printf("    %-20s %7.2f us\n", ingestCases[i].name, timeCase(&ingestCases[i], BENCH_PIXELS) / 1000.0);
+		}
+		close(wire[0]);
+		close(wire[1]);
+	}
+
+	printf("    %-21s %12s %12s\n", "raster", "nearest", "splat");
+	benchRaster(1024, 256);
+	benchRaster(4096, 256);
+	benchRaster(16384, 512);
+	benchRaster(65536, 1024);
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+/* pixelKernels.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Vectorized pixel conversion routines used while ingesting channel data.
+ * Each kernel has a plain C version, plus SSSE3 (x86, picked at runtime)
+ * and NEON (ARM) versions where the compiler supports them.
+ *
+ * Channel data arrives in RGB (or RGBW) order.  The colorOrders byte in a
+ * channel record is the order the expander would drive its strip in, not
+ * the order of the bytes on the line, so nothing here reorders colors.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __pixelkernels_h__
+#define __pixelkernels_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+void pixelKernelsInit(void);
+const char *pixelKernelsName(void);
+
+// fold white into red, green and blue (saturating at 255), turning 4 byte
+// RGBW pixels into 3 byte RGB
+void rgbwToRgb(const uint8_t *src, uint8_t *dst, uint32_t count);
+
+// compact 4 byte APA102 pixels (brightness/flag byte followed by red,
+// green and blue) to 3 byte RGB
+void apa102ToRgb(const uint8_t *src, uint8_t *dst, uint32_t count);
+
+// pull the 5 bit global brightness out of 4 byte APA102 pixels
+void apa102Brightness(const uint8_t *src, uint8_t *bri, uint32_t count);
+
+// expand 8 bit pixels to 16 bit values scaled linearly by brightness
+// (0-31).  The values themselves keep whatever curve the 8 bit input had.  bri holds one value per pixel, or is NULL for full brightness.
+// Result is round(v * 257 * bri * 2114 / 65536), which is within
+// 2 LSB of v * 257 * bri / 31.
+void expandHdr(const uint8_t *src, const uint8_t *bri, uint16_t *dst, uint32_t pixels, uint8_t elements);
+
+// run each element of each pixel through its own 256 entry table,
+// lut[0] for the first element, lut[1] for the second and so on.
+void applyLut(const uint8_t *src, uint8_t *dst, uint32_t pixels, uint8_t elements, const uint8_t (*lut)[256]);
+
+// fast 64 bit non-cryptographic hash, for spotting repeated frames.
+// Same structure as xxHash64: four independent multiply-rotate lanes over
+// 32 byte stripes, so it runs at close to memory speed without SIMD.
+uint64_t hashBytes(const uint8_t *data, size_t len, uint64_t seed);
+
+// running CRC-32 (the zlib/Ethernet polynomial), as used for expander
+// channel records.  Start from CRC32_INIT, and xor the result with it
+// to finish.
+#define CRC32_INIT 0xffffffff
+uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t len);
+
+#endif /* __pixelkernels_h__ */
@@ -0,0 +1,68 @@
+/* pixelRaster.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Draws each frame as a W x H RGB image, for web previews and video
+ * pipelines that want a picture instead of a list of pixels.
+ *
+ * The map file gives an x,y position for each physical pixel (counting
+ * across all channels in channel order), like the Pixelblaze mapper.  A
+ * JSON array of [x,y] arrays works as is, and so does one "x y" or "x,y"
+ * pair per line.  Extra coordinates (z) are ignored, and lines starting
+ * with # are comments.  The map is scaled to fit the image with its
+ * aspect ratio kept, and centered.
+ *
+ * Nearest mode lights the one image pixel closest to each LED.  Splat
+ * mode draws each LED as a soft dot sized from the map's density, and
+ * blends dots where they overlap.
+ *
+ * Where each LED lands never changes, so the geometry becomes a scatter
+ * plan sorted by image pixel once, at startup.  Only the byte offset of
+ * each LED in the frame depends on the channel layout, and that small
+ * table is rebuilt when the layout changes.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __pixelraster_h__
+#define __pixelraster_h__
+
+#include <stdint.h>
+
+#include "frameStore.h"
+
+#define RASTER_NEAREST 0
+#define RASTER_SPLAT   1
+#define RASTER_NO_PIXEL 0xffffffff        // LED offset for a mapped pixel the frame doesn't have
+#define DEFAULT_RASTER_SIZE 256           // image width and height
+#define MAX_RASTER_PIXELS (4096 * 4096)
+
+typedef struct {
+    uint32_t dst;                         // image pixel
+    uint32_t led;                         // map entry that lights it
+    uint32_t weight;                      // in 256ths of an LED
+} rasterEntry;
+
+typedef struct {
+    char *path;
+    float *x, *y;                         // LED positions from the map file
+    uint32_t count;                       // LEDs in the map
+    int width, height;
+    int mode;                             // RASTER_NEAREST or RASTER_SPLAT
+    float radius;                         // splat radius, in image pixels
+    rasterEntry *plan;                    // scatter plan, sorted by image pixel
+    uint32_t planCount;
+    uint32_t *offset;                     // byte offset of each LED in the frame
+    int planned;                          // offsets match layout
+    uint32_t layout;                      // frameStore layout the offsets were built for
+    uint8_t *image;                       // width * height RGB
+    size_t imageSize;
+} pixelRaster;
+
+pixelRaster *createPixelRaster(const char *path, int width, int height, int mode);
+const uint8_t *pixelRasterFrame(pixelRaster *pr, const frameStore *fs);
+void destroyPixelRaster(pixelRaster *pr);
+
+#endif /* __pixelraster_h__ */
@@ -0,0 +1,244 @@
+/* pixelRemap.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Strip order to logical order pixel remapping.  See pixelRemap.h.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "pixelRemap.h"
+
+// read the map file.  Returns the number of entries, or -1.
+static long loadMap(pixelRemap *rm) {
+	FILE *f;
+	int c;
+	long n = 0, size = 1024;
+
+	f = fopen(rm->path, "r");
+	if (f == NULL) {
+		printf("pbxTeleporter: unable to open map file %s\n", rm->path);
+		return -1;
+	}
+
+	rm->map = (uint32_t *) malloc(size * sizeof(uint32_t));
+	while ((c = fgetc(f)) != EOF) {
+		if (c == '#') {
+			while ((c = fgetc(f)) != EOF && c != '\n');
+			continue;
+		}
+		if (isspace(c) || c == ',' || c == '[' || c == ']') continue;
+
+		if (isdigit(c) || c == '-') {
+			long v;
+			ungetc(c, f);
+			if (fscanf(f, "%ld", &v) != 1) break;
+			if (v >= MAX_FRAME_PIXELS) break;
+			if (n == size) {
+				size *= 2;
+				rm->map = (uint32_t *) realloc(rm->map, size * sizeof(uint32_t));
+			}
+			rm->map[n++] = (v < 0) ? REMAP_HOLE : (uint32_t) v;
+			continue;
+		}
+		break;
+	}
+
+	if (c != EOF || n == 0) {
+		printf("pbxTeleporter: %s is not a pixel map\n", rm->path);
+		n = -1;
+	}
+	fclose(f);
+	return n;
+}
+
+pixelRemap *createPixelRemap(const char *path) {
+	pixelRemap *rm;
+	long n;
+
+	rm = (pixelRemap *) calloc(1, sizeof(pixelRemap));
+	rm->path = strdup(path);
+
+	n = loadMap(rm);
+	if (n < 0) {
+		destroyPixelRemap(rm);
+		return NULL;
+	}
+	rm->count = (uint32_t) n;
+	rm->plan = (remapEntry *) malloc(rm->count * sizeof(remapEntry));
+	rm->brightness = (uint8_t *) malloc(rm->count);
+
+	return rm;
+}
+
+// channel of src holding physical pixel p.  Maps are mostly runs of
+// neighbouring pixels, so the last answer is checked first.
+static int sourceChannel(const frameStore *src, uint32_t p, int last) {
+	const channelEntry *e = &src->dir[last];
+	if (e->length && p >= src->pixelOffset[last] && p < src->pixelOffset[last] + e->pixels) return last;
+
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		e = &src->dir[i];
+		if (e->length && p >= src->pixelOffset[i] && p < src->pixelOffset[i] + e->pixels) return i;
+	}
+	return last;
+}
+
+// build the gather plan for the layout of src.  Entries are bucketed by
+// source block with a counting sort, which keeps them in output order
+// within each block.
+static void buildPlan(pixelRemap *rm, const frameStore *src, size_t capacity) {
+	uint32_t blocks, *start, n = 0;
+	remapEntry *sorted;
+	int channel = 0;
+
+	rm->planned = 1;
+	rm->layout = src->layout;
+	rm->planCount = 0;
+	rm->holes = 0;
+	memset(rm->sources, 0, sizeof(rm->sources));
+
+// all channels have to have the same pixel size for pixel indexes to
+// mean anything
+	rm->elements = 0;
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		if (src->dir[i].length == 0) continue;
+		if (rm->elements && (src->dir[i].elements != rm->elements)) {
+			printf("pbxTeleporter: channels have mixed pixel sizes, not remapping\n");
+			rm->elements = 0;
+			return;
+		}
+		rm->elements = src->dir[i].elements;
+	}
+	if (rm->elements == 0) return;
+
+	rm->outPixels = rm->count;
+	if ((size_t) rm->outPixels * rm->elements > capacity) {
+		rm->outPixels = capacity / rm->elements;
+	}
+	if (rm->outPixels > MAX_FRAME_PIXELS) rm->outPixels = MAX_FRAME_PIXELS;
+
+	blocks = src->pixelCount / REMAP_BLOCK_PIXELS + 1;
+	start = (uint32_t *) calloc(blocks + 1, sizeof(uint32_t));
+	sorted = (remapEntry *) malloc(rm->outPixels * sizeof(remapEntry));
+
+	for (uint32_t i = 0; i < rm->outPixels; i++) {
+		uint32_t p = rm->map[i];
+		if (p >= src->pixelCount) {
+			rm->holes = 1;
+			continue;
+		}
+		rm->plan[n].dst = i * rm->elements;
+		rm->plan[n].src = p * rm->elements;
+		channel = sourceChannel(src, p, channel);
+		rm->sources[i / MAX_CHANNEL_PIXELS] |= 1ULL << channel;
+		start[p / REMAP_BLOCK_PIXELS + 1]++;
+		n++;
+	}
+	for (uint32_t b = 1; b <= blocks; b++) start[b] += start[b - 1];
+	for (uint32_t i = 0; i < n; i++) {
+		sorted[start[rm->plan[i].src / rm->elements / REMAP_BLOCK_PIXELS]++] = rm->plan[i];
+	}
+	memcpy(rm->plan, sorted, n * sizeof(remapEntry));
+	rm->planCount = n;
+
+	free(sorted);
+	free(start);
+}
+
+// stale if any source is, and the sources' protocol if they agree
+static void sourceFlags(const pixelRemap *rm, const frameStore *src, int channel, channelEntry *out) {
+	int protocol = -1;
+
+	out->protocol = PROTOCOL_NONE;
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		if (!(rm->sources[channel] & (1ULL << i))) continue;
+		out->flags |= src->dir[i].flags & CHANNEL_STALE;
+		if (protocol < 0) protocol = src->dir[i].protocol;
+		else if (protocol != src->dir[i].protocol) protocol = PROTOCOL_NONE;
+	}
+	if (protocol > 0) out->protocol = protocol;
+}
+
+// make dst a copy of src with its pixels in logical order, stored in
+// buffer.  The directory describes the remapped frame as consecutive
+// channels of up to MAX_CHANNEL_PIXELS, with flags and protocol taken from
+// the channels that feed them.  If the layout can't be remapped, dst is
+// just src.
+void pixelRemapFrame(pixelRemap *rm, const frameStore *src, frameStore *dst, uint8_t *buffer, size_t capacity) {
+	const uint8_t *in = src->data;
+	const remapEntry *e;
+	uint32_t n, left, length;
+	int apa102 = 0;
+
+	if (!rm->planned || (rm->layout != src->layout)) buildPlan(rm, src, capacity);
+	if (rm->elements == 0) {
+		*dst = *src;
+		return;
+	}
+
+	e = rm->plan;
+	n = rm->planCount;
+	length = rm->outPixels * rm->elements;
+	if (rm->holes) memset(buffer, 0, length);
+
+	if (rm->elements == 3) {
+		for (; n; n--, e++) {
+			memcpy(buffer + e->dst, in + e->src, 3);
+		}
+	}
+	else {
+		for (; n; n--, e++) {
+			memcpy(buffer + e->dst, in + e->src, rm->elements);
+		}
+	}
+
+// brightness only matters if some channel has it
+	for (int i = 0; i < MAX_CHANNELS; i++) {
+		if (src->dir[i].length && src->dir[i].protocol == PROTOCOL_APA102) apa102 = 1;
+	}
+	if (apa102) {
+		if (rm->holes) memset(rm->brightness, 0, rm->outPixels);
+		for (e = rm->plan, n = rm->planCount; n; n--, e++) {
+			rm->brightness[e->dst / rm->elements] = src->brightness[e->src / rm->elements];
+		}
+	}
+
+	memset(dst, 0, sizeof(frameStore));
+	dst->data = buffer;
+	dst->capacity = capacity;
+	dst->length = length;
+	dst->pixelCount = rm->outPixels;
+	dst->maxPixels = src->maxPixels;
+	dst->layout = src->layout;
+	dst->brightness = rm->brightness;
+
+	left = rm->outPixels;
+	for (int i = 0; i < MAX_CHANNELS && left; i++) {
+		uint32_t pixels = (left > MAX_CHANNEL_PIXELS) ? MAX_CHANNEL_PIXELS : left;
+		dst->dir[i].offset = (rm->outPixels - left) * rm->elements;
+		dst->dir[i].length = pixels * rm->elements;
+		dst->dir[i].pixels = pixels;
+		dst->dir[i].elements = rm->elements;
+		dst->pixelOffset[i] = rm->outPixels - left;
+		sourceFlags(rm, src, i, &dst->dir[i]);
+		left -= pixels;
+	}
+}
+
+void destroyPixelRemap(pixelRemap *rm) {
+	if (rm == NULL) return;
+
+	free(rm->map);
+	free(rm->plan);
+	free(rm->brightness);
+	free(rm->path);
+	free(rm);
+}
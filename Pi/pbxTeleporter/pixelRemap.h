@@ -0,0 +1,63 @@
+/* pixelRemap.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Puts pixels in logical order for clients, so serpentine matrices and
+ * oddly wired sculptures don't have to be unscrambled by every viewer.
+ *
+ * The map file lists, for each logical pixel in order, the index of the
+ * physical pixel (counting across all channels in channel order) that
+ * drives it, or -1 for a hole.  Numbers can be separated by whitespace or
+ * commas, and brackets are ignored, so a JSON array works as is.  Lines
+ * starting with # are comments.
+ *
+ * The map is turned into a gather plan of byte offsets for the current
+ * channel layout, and rebuilt when the layout changes.  The plan is sorted
+ * by source block so that reads for a big map stay within a cache sized
+ * piece of the frame at a time.
+ *
+ * The remapped frame is described as consecutive channels of up to
+ * MAX_CHANNEL_PIXELS.  Each of those takes the stale flag of any source
+ * channel that feeds it, and the protocol its sources share, and APA102
+ * brightness is gathered along with the pixels so HDR output still works.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __pixelremap_h__
+#define __pixelremap_h__
+
+#include <stdint.h>
+
+#include "frameStore.h"
+
+#define REMAP_BLOCK_PIXELS 32768          // source pixels per cache block, 96K of RGB
+#define REMAP_HOLE 0xffffffff             // map entry for a logical pixel with no source
+
+typedef struct {
+    uint32_t dst;                         // byte offset in the remapped frame
+    uint32_t src;                         // byte offset in the incoming frame
+} remapEntry;
+
+typedef struct {
+    char *path;
+    uint32_t *map;                        // physical pixel for each logical pixel
+    uint32_t count;                       // logical pixels
+    remapEntry *plan;                     // gather plan for the current layout
+    uint32_t planCount;
+    uint32_t outPixels;                   // logical pixels that fit in the output buffer
+    uint8_t elements;                     // bytes per pixel, 0 if the layout can't be remapped
+    int holes;                            // some logical pixels have no source
+    int planned;                          // plan matches layout
+    uint32_t layout;                      // frameStore layout the plan was built for
+    uint64_t sources[MAX_CHANNELS];       // source channels feeding each output channel
+    uint8_t *brightness;                  // remapped brightness plane, count bytes
+} pixelRemap;
+
+pixelRemap *createPixelRemap(const char *path);
+void pixelRemapFrame(pixelRemap *rm, const frameStore *src, frameStore *dst, uint8_t *buffer, size_t capacity);
+void destroyPixelRemap(pixelRemap *rm);
+
+#endif /* __pixelremap_h__ */
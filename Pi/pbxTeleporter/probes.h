@@ -0,0 +1,57 @@
+/* probes.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * USDT (SystemTap/DTrace style) static probes, so bpftrace, perf or stap
+ * can watch the protocol and network paths of a running bridge.  A probe
+ * compiles to a single nop plus an ELF note describing where its
+ * arguments live, so it costs nothing until a tracer attaches.
+ *
+ * Probes, in provider "pbxteleporter":
+ *   magic(seq)                               magic word found
+ *   record(seq, channel, pixels, bytes, stored) channel record header read
+ *   crc_error(seq, channel)                  channel record failed its CRC
+ *   draw_all(seq, pixels, bytes)             frame complete, handed off
+ *   request(addr, port, bytes, format)       UDP client asked for a frame
+ *   udp_send(seq, addr, format, result)      frame sent to a UDP client
+ *
+ * seq counts frames, so a frame's records and sends share its number.
+ * addr is the client's IPv4 address in network byte order.  For example:
+ *
+ *   bpftrace -e 'usdt:./pbxTeleporter:pbxteleporter:draw_all { @[pid] = count(); }'
+ *
+ * The probes need <sys/sdt.h>, from systemtap-sdt-dev on Debian and
+ * Raspberry Pi OS.  Without it they compile away to nothing.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __probes_h__
+#define __probes_h__
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PBX_PROBES 1
+#endif
+#endif
+
+#ifdef PBX_PROBES
+#define PROBE1(name, a)                DTRACE_PROBE1(pbxteleporter, name, a)
+#define PROBE2(name, a, b)             DTRACE_PROBE2(pbxteleporter, name, a, b)
+#define PROBE3(name, a, b, c)          DTRACE_PROBE3(pbxteleporter, name, a, b, c)
+#define PROBE4(name, a, b, c, d)       DTRACE_PROBE4(pbxteleporter, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e)    DTRACE_PROBE5(pbxteleporter, name, a, b, c, d, e)
+#else
+// mention the arguments so variables kept only for a probe don't warn,
+// but leave them unevaluated
+#define PROBE1(name, a)                do { (void) sizeof(a); } while (0)
+#define PROBE2(name, a, b)             do { (void) (sizeof(a) + sizeof(b)); } while (0)
+#define PROBE3(name, a, b, c)          do { (void) (sizeof(a) + sizeof(b) + sizeof(c)); } while (0)
+#define PROBE4(name, a, b, c, d)       do { (void) (sizeof(a) + sizeof(b) + sizeof(c) + sizeof(d)); } while (0)
+#define PROBE5(name, a, b, c, d, e)    do { (void) (sizeof(a) + sizeof(b) + sizeof(c) + sizeof(d) + sizeof(e)); } while (0)
+#endif
+
+#endif /* __probes_h__ */
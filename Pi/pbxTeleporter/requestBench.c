@@ -0,0 +1,118 @@
+/* requestBench.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Round trip times of UDP frame requests to a running bridge, for
+ * requests that wait for the next frame and for PBX_REQUEST_NOW requests
+ * answered from the latest one.  The two kinds alternate, each sent after
+ * a random 5-45 ms gap so they land all over the frame period.
+ *
+ * Replies come back to the send port, like they do for any client, so
+ * nothing else on this machine can be listening there.
+ *
+ * usage: requestBench [requests of each kind] [bridge address]   (default 200, 127.0.0.1)
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "udpServer.h"
+
+#define LISTEN_PORT 8081                  // bridge's default --listen-port
+#define SEND_PORT   8082                  // bridge's default --send-port
+
+static double milliTime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int compareTimes(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x < y) ? -1 : (x > y);
+}
+
+static void report(const char *name, double *rtt, int n) {
+	double sum = 0;
+
+	if (n == 0) {
+		printf("    %-5s no replies\n", name);
+		return;
+	}
+	qsort(rtt, n, sizeof(double), compareTimes);
+	for (int i = 0; i < n; i++) sum += rtt[i];
+	printf("    %-5s mean %6.2f  p50 %6.2f  p99 %6.2f  max %6.2f ms\n",
+		name, sum / n, rtt[n / 2], rtt[n * 99 / 100], rtt[n - 1]);
+}
+
+int main(int argc, char *argv[]) {
+	int count = (argc > 1) ? atoi(argv[1]) : 200;
+	const char *host = (argc > 2) ? argv[2] : "127.0.0.1";
+	struct sockaddr_in local, bridge;
+	struct timeval timeout = { 1, 0 };
+	static uint8_t reply[65536];
+	double *rtt[2];
+	int got[2] = { 0, 0 }, lost = 0, fd;
+
+	if (count <= 0) {
+		printf("usage: requestBench [requests of each kind] [bridge address]\n");
+		return 1;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(SEND_PORT);
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd, (struct sockaddr *) &local, sizeof(local)) < 0) {
+		printf("requestBench: unable to bind port %d\n", SEND_PORT);
+		return 1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	memset(&bridge, 0, sizeof(bridge));
+	bridge.sin_family = AF_INET;
+	bridge.sin_port = htons(LISTEN_PORT);
+	bridge.sin_addr.s_addr = inet_addr(host);
+
+	rtt[0] = (double *) malloc(count * sizeof(double));
+	rtt[1] = (double *) malloc(count * sizeof(double));
+
+	srand(1);
+	for (int i = 0; i < 2 * count; i++) {
+		int now = i & 1;
+		pbxRequest req;
+		double t;
+
+		memcpy(req.magic, PBX_REQUEST_MAGIC, sizeof(req.magic));
+		req.version = PBX_REQUEST_VERSION;
+		req.format = FORMAT_RGB8;
+		req.flags = now ? PBX_REQUEST_NOW : 0;
+		req.reserved = 0;
+
+		usleep(5000 + rand() % 40000);
+		t = milliTime();
+		sendto(fd, &req, sizeof(req), 0, (struct sockaddr *) &bridge, sizeof(bridge));
+		if (recv(fd, reply, sizeof(reply), 0) <= 0) {
+			lost++;
+			continue;
+		}
+		rtt[now][got[now]++] = milliTime() - t;
+	}
+
+	printf("requestBench: %d requests of each kind to %s, %d unanswered\n", count, host, lost);
+	report("next", rtt[0], got[0]);
+	report("now", rtt[1], got[1]);
+
+	free(rtt[0]);
+	free(rtt[1]);
+	close(fd);
+	return 0;
+}
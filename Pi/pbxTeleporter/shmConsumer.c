@@ -0,0 +1,102 @@
+/* shmConsumer.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Example consumer for the pbxTeleporter shared memory frame ring.  Attaches
+ * to a running bridge, waits for frames and prints a short summary of each
+ * one along with the measured frame rate.
+ *
+ * usage: shmConsumer [shm name]   (default /pbxTeleporter)
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include "pbxShmReader.h"
+
+int runFlag = 1;
+
+void consumerSignalHandler(int s) {
+	runFlag = 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *name = (argc > 1) ? argv[1] : SHM_DEFAULT_NAME;
+	pbxShmReader *reader;
+	pbxShmFrame frame;
+	uint64_t lastSeq = 0, dropped = 0;
+	uint32_t frames = 0;
+	time_t lastReport;
+	int res;
+
+	signal(SIGINT, consumerSignalHandler);
+
+	reader = pbxShmOpen(name);
+	if (reader == NULL) {
+		if (errno == EACCES) {
+			printf("shmConsumer: no access to frame ring %s. Run as pbxTeleporter's user or in its group.\n", name);
+		}
+		else {
+			printf("shmConsumer: unable to open frame ring %s. Is pbxTeleporter running with --shm?\n", name);
+		}
+		return 1;
+	}
+	printf("shmConsumer: attached to %s, %u slots\n", name, reader->hdr->slotCount);
+
+	lastReport = time(NULL);
+	while (runFlag) {
+		res = pbxShmWait(reader, 1000);
+		if (res < 0) break;
+		if (res == 0) {
+			printf("shmConsumer: waiting for frames...\n");
+			continue;
+		}
+
+		if (!pbxShmAcquire(reader, &frame)) continue;
+
+		// read the frame in place.  Here we just count the pixels and peek
+		// at the first one.  Channels can differ in bytes per pixel (RGB or
+		// RGBW), so both come from the channel directory.
+		uint8_t first[4] = {0, 0, 0, 0};
+		uint32_t pixels = 0, elements = 0;
+		for (uint32_t i = 0; i < frame.channelCount; i++) {
+			const channelEntry *ch = &frame.directory[i];
+			if (ch->length == 0) continue;
+			if (elements == 0 && ch->elements <= 4 && ch->offset + ch->elements <= frame.length) {
+				elements = ch->elements;
+				for (uint32_t e = 0; e < elements; e++) first[e] = frame.data[ch->offset + e];
+			}
+			pixels += ch->pixels;
+		}
+		if (!pbxShmValidate(reader, &frame)) continue;
+
+		if (lastSeq && frame.frameSeq > lastSeq + 1) dropped += frame.frameSeq - lastSeq - 1;
+		lastSeq = frame.frameSeq;
+		frames++;
+
+		if (time(NULL) != lastReport) {
+			printf("frame %llu: %u pixels, first pixel ", (unsigned long long) frame.frameSeq, pixels);
+			for (uint32_t e = 0; e < elements; e++) printf("%02x", first[e]);
+			printf(", %u fps, %llu skipped\n", frames, (unsigned long long) dropped);
+			for (uint32_t i = 0; i < frame.channelCount; i++) {
+				const channelEntry *ch = &frame.directory[i];
+				if (ch->length == 0) continue;
+				printf("    channel %u: %u pixels of %u bytes at offset %u%s\n", i, ch->pixels, ch->elements, ch->offset,
+					(ch->flags & CHANNEL_STALE) ? " (stale)" : "");
+			}
+			frames = 0;
+			lastReport = time(NULL);
+		}
+	}
+
+	pbxShmClose(reader);
+	return 0;
+}
@@ -0,0 +1,84 @@
+/* shmRing.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Shared memory frame ring for consumers running on the same machine as the
+ * bridge.  Completed frames are published into a POSIX shared memory object
+ * made up of a small header followed by N fixed size slots.  Each slot is
+ * guarded by a sequence lock, and the header carries a futex word that
+ * readers can sleep on until the next frame arrives.  Each slot holds the
+ * frame's channel directory (see frameStore.h) followed by the pixel data.
+ *
+ * Readers map the ring read/write, because they sleep on the futex word
+ * and keep the waiter and reader counts.  So the object is created with
+ * SHM_RING_MODE, and a consumer has to run as the bridge's user or in its
+ * group.
+ *
+ * This header describes the memory layout and is shared by the bridge and
+ * by the reader library (pbxShmReader.h).
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __shmring_h__
+#define __shmring_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "frameStore.h"
+
+#define SHM_RING_MAGIC      0x4c585055    // "UPXL", little endian
+#define SHM_RING_VERSION    2
+#define SHM_DEFAULT_NAME    "/pbxTeleporter"
+#define SHM_DEFAULT_SLOTS   4
+#define SHM_MAX_SLOTS       64
+#define SHM_SLOT_HDR_SIZE   64            // slot header, one cache line
+#define SHM_RING_MODE       0660          // readers need write access too
+
+// ring header -- lives at offset 0 of the shared memory object.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;                   // number of frame slots
+    uint32_t slotSize;                    // bytes per slot, including slot header
+    uint32_t dataOffset;                  // offset of slot 0 from start of object
+    uint32_t maxFrameSize;                // largest frame (in bytes) a slot can hold
+    uint32_t futex;                       // bumped on every publish, FUTEX_WAIT on this
+    uint32_t waiters;                     // readers sleeping on the futex
+    uint64_t frameSeq;                    // sequence number of newest complete frame
+    uint32_t readers;                     // attached readers (maintained by reader lib)
+    uint32_t channelCount;                // entries in each slot's channel directory
+    uint32_t slotDataOffset;              // offset of pixel data from start of slot
+    uint32_t reserved[3];
+} shmRingHeader;
+
+// per-slot header. seq is the sequence lock -- odd while the slot
+// is being written, even when the slot contents are stable.
+typedef struct {
+    uint32_t seq;
+    uint32_t length;                      // bytes of pixel data in slot
+    uint64_t frameSeq;                    // frame number held by this slot
+    uint64_t timestamp;                   // CLOCK_MONOTONIC nanoseconds at publish
+    uint8_t  reserved[SHM_SLOT_HDR_SIZE - 24];
+} shmSlotHeader;
+
+typedef struct _shmRing {
+    char *name;                           // NULL for memfd backed rings
+    int fd;
+    size_t mapSize;
+    shmRingHeader *hdr;
+    uint8_t *base;
+} shmRing;
+
+// address of slot n's header, channel directory and pixel data
+#define shmSlot(hdr,n)          ((shmSlotHeader *) ((uint8_t *) (hdr) + (hdr)->dataOffset + (size_t) (n) * (hdr)->slotSize))
+#define shmSlotDirectory(slot)  ((channelEntry *) ((uint8_t *) (slot) + SHM_SLOT_HDR_SIZE))
+#define shmSlotData(hdr,slot)   ((uint8_t *) (slot) + (hdr)->slotDataOffset)
+
+shmRing *createShmRing(const char *name, int slots, size_t maxFrameSize);
+uint64_t shmRingPublish(shmRing *ring, const frameStore *frame);
+void destroyShmRing(shmRing *ring);
+
+#endif /* __shmring_h__ */
@@ -0,0 +1,62 @@
+/* trace.h
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Timeline tracing for deep-dive debugging.  With --trace, each thread
+ * records spans (serial reads, channel records, transform stages, sends)
+ * into its own ring, and a background thread drains the rings to a file
+ * in Chrome trace event JSON, which chrome://tracing and ui.perfetto.dev
+ * both load.
+ *
+ * Each ring has one writer (its thread) and one reader (the flush
+ * thread), so recording a span is two stores and a release, with no
+ * locks.  If the flush thread falls behind, new spans are dropped and
+ * counted rather than waited for.
+ *
+ * When tracing is off, TRACE_BEGIN and TRACE_END are a single branch
+ * on a global, marked unlikely so the compiler moves the tracing code
+ * out of line.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#ifndef __trace_h__
+#define __trace_h__
+
+#include <stdint.h>
+
+#define TRACE_RING_EVENTS 32768           // spans per thread between flushes, a power of two
+#define TRACE_FLUSH_MS    100
+
+typedef struct {
+    const char *name;                     // string literal, written out as is
+    uint64_t start;                       // latencyNow() times
+    uint64_t end;
+    int64_t arg;                          // channel, client and so on, -1 for none
+} traceEvent;
+
+typedef struct {
+    traceEvent events[TRACE_RING_EVENTS];
+    uint32_t head;                        // next slot to write, owned by the thread
+    uint32_t tail;                        // next slot to flush, owned by the flush thread
+    uint64_t dropped;
+    int tid;
+    const char *name;
+} traceRing;
+
+extern int traceEnabled;
+
+void traceSpan(const char *name, uint64_t start, int64_t arg);
+uint64_t traceNow(void);
+void traceThread(const char *name);
+int createTrace(const char *path);
+void destroyTrace(void);
+
+// uint64_t t = TRACE_BEGIN(); ... TRACE_END("name", t, arg);
+#define TRACE_BEGIN() (__builtin_expect(traceEnabled, 0) ? traceNow() : 0)
+#define TRACE_END(name, start, arg) \
+	do { if (__builtin_expect(traceEnabled, 0)) traceSpan((name), (start), (arg)); } while (0)
+
+#endif /* __trace_h__ */
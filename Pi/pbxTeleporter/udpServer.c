@@ -14,6 +14,9 @@
 */
 #include "udpServer.h"
 #include "pbxTeleporter.h"
+#include "metrics.h"
+#include "probes.h"
+#include "latency.h"
 
 
 #define UDP_INBUFSIZE 256 // size of buffer for incoming UPD data.
@@ -39,7 +42,7 @@ void _debugPrintAddress(struct sockaddr_in *addr) {
   printf("%s (%s)\n",  hostp->h_name, hostaddrp);
 }
 
-udpServer *createUdpServer(char *bind_addr, int listen_port, int send_port) {
+udpServer *createUdpServer(char *bind_addr, int listen_port, int send_port, frameQueue *queue) {
   udpServer *udp;
   int options;
 	
@@ -47,6 +50,11 @@ udpServer *createUdpServer(char *bind_addr, int listen_port, int send_port) {
   udp->clientlen = sizeof(struct sockaddr_in);
   udp->listen_port = listen_port;
   udp->send_port = send_port;
+  udp->pendingCount = 0;
+  udp->immediateCount = 0;
+  udp->queue = queue;
+  udp->lastRequest = 0;
+  pthread_mutex_init(&udp->lock, NULL);
 	
 // open socket	
   udp->fd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -95,39 +103,141 @@ int udpServerListen(udpServer *udp,uint8_t *rcvbuf,size_t bufsize) {
 		 (struct sockaddr *) &udp->client, (socklen_t *) &udp->clientlen);
 }
 
-int udpServerSend(udpServer *udp, uint8_t *sendbuf,size_t bufsize) {
-	udp->client.sin_port = htons(udp->send_port);
-	return sendto(udp->fd,  sendbuf, (int) bufsize, 0,
-		(struct sockaddr*)&udp->client, udp->clientlen);
+int udpServerSend(udpServer *udp, struct sockaddr_in *client, uint8_t *sendbuf,size_t bufsize) {
+	int res;
+
+	client->sin_port = htons(udp->send_port);
+	res = sendto(udp->fd,  sendbuf, (int) bufsize, 0,
+		(struct sockaddr*) client, sizeof(struct sockaddr_in));
+
+	if (res < 0) {
+		metricAdd(M_UDP_SEND_ERRORS,1);
+	}
+	else {
+		metricAdd(M_UDP_SENDS,1);
+		metricAdd(M_UDP_BYTES_SENT,res);
+	}
+	return res;
+}
+
+// add a request to a list.  A client that asks again before it's been
+// answered just has its request updated.  Call with the lock held.
+static void addRequest(pendingRequest *list, int *count, const pendingRequest *request) {
+  int i;
+
+  for (i = 0; i < *count; i++) {
+    if ((list[i].addr.sin_addr.s_addr == request->addr.sin_addr.s_addr) &&
+        (list[i].addr.sin_port == request->addr.sin_port)) break;
+  }
+  if (i < MAX_PENDING_REQUESTS) {
+    list[i] = *request;
+    if (i == *count) (*count)++;
+  }
+}
+
+// queue a request from the client we just heard from.  PBX_REQUEST_NOW
+// requests go on the immediate list once there's a frame to answer them
+// from, everything else waits for the next frame.  Returns 1 if the
+// request was immediate.
+static int udpServerQueueRequest(udpServer *udp, uint8_t *req, int len, uint64_t now) {
+  pbxRequest *r = (pbxRequest *) req;
+  pendingRequest request;
+  int immediate;
+
+  request.addr = udp->client;
+  request.format = FORMAT_RGB8;
+  request.flags = 0;
+  request.received = now;
+  if ((len >= (int) sizeof(pbxRequest)) && (memcmp(r->magic, PBX_REQUEST_MAGIC, 4) == 0)) {
+    if (r->format < FORMAT_COUNT) request.format = r->format;
+    request.flags = r->flags;
+  }
+  PROBE4(request, udp->client.sin_addr.s_addr, ntohs(udp->client.sin_port), len, request.format);
+
+  immediate = (request.flags & PBX_REQUEST_NOW) && (pixelsReady > 0);
+
+  pthread_mutex_lock(&udp->lock);
+  if (immediate) {
+    addRequest(udp->immediate, &udp->immediateCount, &request);
+  }
+  else {
+    addRequest(udp->pending, &udp->pendingCount, &request);
+  }
+  pthread_mutex_unlock(&udp->lock);
+
+  return immediate;
+}
+
+// put an immediate request back to wait for the next frame, for when the
+// latest one is too old to be worth sending
+void udpServerDefer(udpServer *udp, const pendingRequest *request) {
+  pthread_mutex_lock(&udp->lock);
+  addRequest(udp->pending, &udp->pendingCount, request);
+  pthread_mutex_unlock(&udp->lock);
+  clientRequestFlag = 1;
+}
+
+// hand a list of waiting clients to the caller, and start a new one.
+// requests must have room for MAX_PENDING_REQUESTS entries.
+static int takeRequests(udpServer *udp, pendingRequest *list, int *count, pendingRequest *requests) {
+  int n;
+
+  pthread_mutex_lock(&udp->lock);
+  n = *count;
+  memcpy(requests, list, n * sizeof(pendingRequest));
+  *count = 0;
+  pthread_mutex_unlock(&udp->lock);
+
+  return n;
+}
+
+// clients waiting for the next frame
+int udpServerTakeRequests(udpServer *udp, pendingRequest *requests) {
+  return takeRequests(udp, udp->pending, &udp->pendingCount, requests);
+}
+
+// clients that want the latest frame now
+int udpServerTakeImmediate(udpServer *udp, pendingRequest *requests) {
+  return takeRequests(udp, udp->immediate, &udp->immediateCount, requests);
 }
 
 void destroyUdpServer(udpServer *udp) {
   pthread_join(udp->pt, NULL);
   if (udp != NULL) {
+    pthread_mutex_destroy(&udp->lock);
     free(udp);
   }
 }
 
-// UDP Server thread function. Once data becomes available, does a blocking
-// listen for requests, and requests a send operation on the next complete
-// frame received from the Pixelblaze.
-// TODO -  SCHEDULING!  We technically support multiple clients but do not queue 
-// client requests and thus may lose requests if several come in simultaneously.
+// UDP Server thread function. Does a blocking listen for requests, and
+// queues a send operation on the next complete frame received from the
+// Pixelblaze.  Up to MAX_PENDING_REQUESTS clients can be waiting for the
+// same frame.  Requests that arrive before the first frame, or while the
+// serial thread is idling because nobody was listening, just wait for the
+// next one.  Immediate requests wake the transform thread, which answers
+// them from the frame it last published.
 void *udpThread(void *arg) {
 	uint8_t incoming_buffer[UDP_INBUFSIZE];
 	udpServer *udp = (udpServer *) arg;
 	int res;
 
 	pthread_detach(pthread_self());
+	metricsThread(METRIC_THREAD_UDP);
 
 	while(runFlag) {
-		if (pixelsReady > 0) {
-			res = udpServerListen(udp,incoming_buffer,UDP_INBUFSIZE);
+		res = udpServerListen(udp,incoming_buffer,UDP_INBUFSIZE);
 
-			if (res > 0) {
-                clientRequestFlag = 1;
-//				udpServerSend(udp,pixel_buffer,pixelsReady);
+		if (res > 0) {
+			uint64_t now = latencyNow();
+
+			if (udpServerQueueRequest(udp,incoming_buffer,res,now)) {
+				frameQueueWake(udp->queue);
+			}
+			else {
+				clientRequestFlag = 1;
 			}
+			metricAdd(M_UDP_REQUESTS,1);
+			__atomic_store_n(&udp->lastRequest, now, __ATOMIC_RELAXED);
 		}
 	}
 
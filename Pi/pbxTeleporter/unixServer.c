@@ -0,0 +1,282 @@
+/* unixServer.c
+ *
+ * Serial -> UDP Bridge for Pixelblaze
+ * Linux/Raspberry Pi version
+ *
+ * Unix domain SOCK_SEQPACKET frame server for local clients.  Skips the
+ * IP stack entirely, and lets clients that ask for it read frames in place
+ * from a memfd ring.  See unixServer.h for the client protocol.
+ *
+ * Part of the PixelTeleporter project
+ * 2021 by JEM (ZRanger1)
+ * Distributed under the MIT license
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "unixServer.h"
+#include "metrics.h"
+#include "trace.h"
+#include "pbxTeleporter.h"
+
+#define UNIX_POLL_MS 250  // how often the listener thread checks runFlag
+
+// close a client connection.  Caller holds the lock.
+static void removeClient(unixServer *us, int i) {
+	close(us->clients[i].fd);
+	us->clientCount--;
+	us->clients[i] = us->clients[us->clientCount];
+}
+
+// make room in a new client's socket buffer for the largest frame.  Asks
+// for more than net.core.wmem_max allows if we have CAP_NET_ADMIN.
+static void sizeSendBuffer(unixServer *us, int fd) {
+	int want = (int) (us->maxFrameSize + UNIX_SNDBUF_SLACK), have = 0;
+	socklen_t len = sizeof(have);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &have, &len) == 0 && have >= want) return;
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &want, sizeof(want)) < 0) {
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &want, sizeof(want));
+	}
+}
+
+// send the memfd ring to a client as SCM_RIGHTS ancillary data
+static int sendRing(unixServer *us, int fd) {
+	unixRingMsg msg;
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+
+	msg.magic = SHM_RING_MAGIC;
+	msg.type = UNIX_MSG_RING;
+	msg.slotCount = us->ring->hdr->slotCount;
+	msg.maxFrameSize = us->ring->hdr->maxFrameSize;
+
+	iov.iov_base = &msg;
+	iov.iov_len = sizeof(msg);
+
+	memset(&mh, 0, sizeof(mh));
+	memset(&control, 0, sizeof(control));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &us->ring->fd, sizeof(int));
+
+	return sendmsg(fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+unixServer *createUnixServer(const char *path, size_t maxFrameSize) {
+	unixServer *us;
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("pbxTeleporter: unix socket path too long\n");
+		return NULL;
+	}
+
+	us = (unixServer *) calloc(1, sizeof(unixServer));
+	us->path = strdup(path);
+	us->maxFrameSize = maxFrameSize;
+	pthread_mutex_init(&us->lock, NULL);
+
+// memfd ring for clients that want zero-copy access
+	us->ring = createShmRing(NULL, SHM_DEFAULT_SLOTS, maxFrameSize);
+	if (us->ring == NULL) {
+		free(us->path);
+		free(us);
+		return NULL;
+	}
+
+	us->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (us->fd < 0) {
+		printf("pbxTeleporter: ERROR opening unix socket\n");
+		destroyShmRing(us->ring);
+		free(us->path);
+		free(us);
+		return NULL;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+// clear out any socket left behind by a previous run
+	unlink(path);
+	if (bind(us->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(us->fd, MAX_UNIX_CLIENTS) < 0) {
+		printf("pbxTeleporter: Bind unix socket %s failed: %s\n", path, strerror(errno));
+		close(us->fd);
+		destroyShmRing(us->ring);
+		free(us->path);
+		free(us);
+		return NULL;
+	}
+
+	pthread_create(&us->pt, NULL, &unixThread, (void *) us);
+
+	return us;
+}
+
+// send a completed frame to every connected client.  Never blocks -- a client
+// whose socket buffer is full, or too small for the frame, just misses it.
+void unixServerPublish(unixServer *us, const frameStore *frame) {
+	unixNotifyMsg note;
+	int i, res, memfdClients = 0;
+	size_t len = frame->length;
+
+	pthread_mutex_lock(&us->lock);
+
+	for (i = 0; i < us->clientCount; i++) {
+		memfdClients += us->clients[i].memfdMode;
+	}
+	if (memfdClients) {
+		note.magic = SHM_RING_MAGIC;
+		note.type = UNIX_MSG_NOTIFY;
+		note.frameSeq = shmRingPublish(us->ring, frame);
+		note.length = (len > us->ring->hdr->maxFrameSize) ? us->ring->hdr->maxFrameSize : len;
+	}
+
+	i = 0;
+	while (i < us->clientCount) {
+		unixClient *c = &us->clients[i];
+		uint64_t t = TRACE_BEGIN();
+
+		if (c->memfdMode) {
+			res = send(c->fd, &note, sizeof(note), MSG_DONTWAIT | MSG_NOSIGNAL);
+		}
+		else {
+			res = send(c->fd, frame->data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		}
+		TRACE_END("unix send",t,c->fd);
+
+		if (res < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EMSGSIZE) {
+				if (errno == EMSGSIZE && !c->tooBig) {
+					printf("pbxTeleporter: %zu byte frame is too big for a unix socket client, use memfd mode\n", len);
+					c->tooBig = 1;
+				}
+				c->dropped++;
+				metricAdd(M_UNIX_DROPS,1);
+			}
+			else {
+				removeClient(us, i);
+				continue;
+			}
+		}
+		else {
+			metricAdd(M_UNIX_SENDS,1);
+		}
+		i++;
+	}
+
+	pthread_mutex_unlock(&us->lock);
+}
+
+void destroyUnixServer(unixServer *us) {
+	if (us == NULL) return;
+
+	pthread_join(us->pt, NULL);
+	for (int i = 0; i < us->clientCount; i++) {
+		close(us->clients[i].fd);
+	}
+	close(us->fd);
+	unlink(us->path);
+	destroyShmRing(us->ring);
+	pthread_mutex_destroy(&us->lock);
+	free(us->path);
+	free(us);
+}
+
+// Unix socket server thread.  Accepts new clients, handles requests for
+// the memfd ring and notices disconnects.  Frames are sent from
+// unixServerPublish() on the transform thread.
+void *unixThread(void *arg) {
+	unixServer *us = (unixServer *) arg;
+	struct pollfd pfd[MAX_UNIX_CLIENTS + 1];
+	uint8_t req[16];
+	int i, j, n, fd, res;
+
+	metricsThread(METRIC_THREAD_UNIX);
+
+	while (runFlag) {
+		pfd[0].fd = us->fd;
+		pfd[0].events = POLLIN;
+
+		pthread_mutex_lock(&us->lock);
+		n = us->clientCount;
+		for (i = 0; i < n; i++) {
+			pfd[i + 1].fd = us->clients[i].fd;
+			pfd[i + 1].events = POLLIN;
+		}
+		pthread_mutex_unlock(&us->lock);
+		metricSet(M_UNIX_CLIENTS,n);
+
+		if (poll(pfd, n + 1, UNIX_POLL_MS) <= 0) continue;
+
+// incoming requests and disconnects
+		for (i = 1; i <= n; i++) {
+			if (pfd[i].revents == 0) continue;
+
+			// the transform thread may have dropped the client since we
+			// polled, so only read from the fd while it's still in the
+			// list.  Only this thread adds clients, so a match is the
+			// same connection, not a reused fd.
+			pthread_mutex_lock(&us->lock);
+			for (j = 0; j < us->clientCount; j++) {
+				if (us->clients[j].fd != pfd[i].fd) continue;
+
+				res = recv(pfd[i].fd, req, sizeof(req), MSG_DONTWAIT);
+				if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+				if (res <= 0) {
+					removeClient(us, j);
+				}
+				else if (req[0] == UNIX_REQ_MEMFD && !us->clients[j].memfdMode) {
+					if (sendRing(us, us->clients[j].fd) > 0) us->clients[j].memfdMode = 1;
+				}
+				break;
+			}
+			pthread_mutex_unlock(&us->lock);
+		}
+
+// new connections
+		if (pfd[0].revents & POLLIN) {
+			fd = accept4(us->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) continue;
+
+			sizeSendBuffer(us, fd);
+
+			pthread_mutex_lock(&us->lock);
+			if (us->clientCount < MAX_UNIX_CLIENTS) {
+				us->clients[us->clientCount].fd = fd;
+				us->clients[us->clientCount].memfdMode = 0;
+				us->clients[us->clientCount].dropped = 0;
+				us->clients[us->clientCount].tooBig = 0;
+				us->clientCount++;
+			}
+			else {
+				close(fd);
+			}
+			pthread_mutex_unlock(&us->lock);
+		}
+	}
+
+	pthread_exit(NULL);
+}